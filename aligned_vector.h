@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace utils::alloc {
+
+// allocator handing out storage aligned to `Alignment` bytes, so SIMD kernels
+// can use aligned loads and arrays don't straddle cache lines.
+template <typename T, size_t Alignment = 64> struct aligned_allocator {
+  using value_type = T;
+  template <typename U> struct rebind {
+    using other = aligned_allocator<U, Alignment>;
+  };
+
+  aligned_allocator() noexcept = default;
+  template <typename U>
+  aligned_allocator(const aligned_allocator<U, Alignment> &) noexcept {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(
+        ::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+  }
+  void deallocate(T *p, size_t) noexcept {
+    ::operator delete(p, std::align_val_t(Alignment));
+  }
+
+  template <typename U>
+  bool operator==(const aligned_allocator<U, Alignment> &) const noexcept {
+    return true;
+  }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, aligned_allocator<T>>;
+
+} // namespace utils::alloc
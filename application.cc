@@ -1,5 +1,6 @@
 #include "application.h"
 #include "log.h"
+#include <algorithm>
 #include <imgui/backends/imgui_impl_glfw.h>
 
 #include "RobotoRegular.embed"
@@ -90,6 +91,9 @@ static void frame_render(const vulkan::Instance &vk,
   if (vkResetFences(vk.device, 1, &fd->Fence) < 0) {
     vklog.error() << "Could not reset fences\n" << vklog.abort();
   }
+  // submissions finish in order, so every frame before this one has too.
+  state.completed_frame =
+      std::max(state.completed_frame, state.submitted_frames[wd->FrameIndex]);
 
   {
     // free resources in queue
@@ -100,15 +104,6 @@ static void frame_render(const vulkan::Instance &vk,
   }
 
   {
-    auto &allocated_command_buffers =
-        state.allocated_command_buffers[wd->FrameIndex];
-    if (allocated_command_buffers.size() > 0) {
-      vkFreeCommandBuffers(vk.device, fd->CommandPool,
-                           (u32)allocated_command_buffers.size(),
-                           allocated_command_buffers.data());
-      allocated_command_buffers.clear();
-    }
-
     if (vkResetCommandPool(vk.device, fd->CommandPool, 0) < 0) {
       vklog.error() << "Could not reset command pool\n" << vklog.abort();
     }
@@ -119,6 +114,12 @@ static void frame_render(const vulkan::Instance &vk,
     if (vkBeginCommandBuffer(fd->CommandBuffer, &info) < 0) {
       vklog.error() << "Could not init command buffer\n" << vklog.abort();
     }
+
+    // uploads first, so the render pass samples what they wrote.
+    for (auto &record : state.transfers)
+      record(fd->CommandBuffer);
+    state.frame_stats.transfers += static_cast<u32>(state.transfers.size());
+    state.transfers.clear();
   }
   {
     VkRenderPassBeginInfo info = {};
@@ -158,6 +159,9 @@ static void frame_render(const vulkan::Instance &vk,
       vklog.error() << "Could not submit commands to the queue\n"
                     << vklog.abort();
     }
+    state.submitted_frames[wd->FrameIndex] = state.frame_number++;
+    state.last_frame_stats = state.frame_stats;
+    state.frame_stats = {};
   }
 }
 
@@ -231,8 +235,8 @@ Application::Application(u32 width, u32 height, std::string_view name) {
     glfwGetFramebufferSize(app.window_handle, &width, &height);
     setup_vulkan_window(*app.vk, &app.window, surface, width, height);
   }
-  app.state.allocated_command_buffers.resize(app.window.ImageCount);
   app.state.resource_free_queue.resize(app.window.ImageCount);
+  app.state.submitted_frames.resize(app.window.ImageCount);
   applog.ok() << "Vulkan setup\n";
 
   applog.info() << "Setting up ImGui...\n";
@@ -353,8 +357,9 @@ void Application::main_loop() {
             vk->instance, vk->physical_device, vk->device, &window,
             vk->queue_family, NULL, width, height, k_min_image_count);
         window.FrameIndex = 0;
-        state.allocated_command_buffers.clear();
-        state.allocated_command_buffers.resize(window.ImageCount);
+        // resizing waited for the device to go idle.
+        state.completed_frame = state.frame_number - 1;
+        state.submitted_frames.assign(window.ImageCount, 0);
         state.rebuild_swapchain = false;
       }
     }
@@ -457,8 +462,33 @@ void Application::submit_resource_free(std::function<void()> &&func) {
   state.resource_free_queue[state.current_frame_index].emplace_back(func);
 }
 
-std::vector<std::vector<VkCommandBuffer>>
-    FrameRenderState::allocated_command_buffers;
+void Application::record_transfer(
+    std::function<void(VkCommandBuffer)> &&record) {
+  state.transfers.emplace_back(std::move(record));
+}
+
+u64 Application::get_frame_number() const noexcept {
+  return state.frame_number;
+}
+
+u64 Application::get_completed_frame() const noexcept {
+  return state.completed_frame;
+}
+
+u32 Application::get_frames_in_flight() const noexcept {
+  return window.ImageCount;
+}
+
+void Application::wait_for_frame(u64 number) {
+  // the next frame's transfers can't be waited for before it's submitted.
+  if (number <= state.completed_frame || number >= state.frame_number)
+    return;
+  if (vkQueueWaitIdle(vk->queue) < 0) {
+    vklog.error() << "Could not wait for the queue\n" << vklog.abort();
+  }
+  state.completed_frame = state.frame_number - 1;
+}
+
 std::vector<std::vector<std::function<void()>>>
     FrameRenderState::resource_free_queue;
 
@@ -483,57 +513,12 @@ Application &Application::get() {
   return s_instance;
 }
 
-VkCommandBuffer Application::get_command_buffer(bool begin) {
-  VkCommandPool command_pool = window.Frames[window.FrameIndex].CommandPool;
-  VkCommandBufferAllocateInfo cmd_alloc_info = {};
-  cmd_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  cmd_alloc_info.commandPool = command_pool;
-  cmd_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  cmd_alloc_info.commandBufferCount = 1;
-
-  VkCommandBuffer &cmd =
-      state.allocated_command_buffers[window.FrameIndex].emplace_back();
-  vkAllocateCommandBuffers(vk->device, &cmd_alloc_info, &cmd);
-
-  VkCommandBufferBeginInfo begin_info = {};
-  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  begin_info.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-  if (vkBeginCommandBuffer(cmd, &begin_info) < 0) {
-    vklog.error() << "Could not begin command buffer\n" << vklog.abort();
-  }
-
-  return cmd;
+void Application::count_allocation() noexcept {
+  ++state.frame_stats.allocations;
 }
-void Application::flush_cmd_buffer(VkCommandBuffer buffer) {
-  const uint64_t DEFAULT_FENCE_TIMEOUT = 100000000000;
-
-  VkSubmitInfo end_info = {};
-  end_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  end_info.commandBufferCount = 1;
-  end_info.pCommandBuffers = &buffer;
-  if (vkEndCommandBuffer(buffer) < 0) {
-    vklog.error() << "Could not build command\n" << vklog.abort();
-  }
-
-  // Create fence to ensure that the command buffer has finished executing
-  VkFenceCreateInfo fenceCreateInfo = {};
-  fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceCreateInfo.flags = 0;
-  VkFence fence;
-  if (vkCreateFence(vk->device, &fenceCreateInfo, nullptr, &fence) < 0) {
-    vklog.error() << "Could not create fence\n" << vklog.abort();
-  }
-
-  if (vkQueueSubmit(vk->queue, 1, &end_info, fence) < 0) {
-    vklog.error() << "Could not submit queue\n" << vklog.abort();
-  }
-
-  if (vkWaitForFences(vk->device, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT) <
-      0) {
-    vklog.error() << "Could not wait for fences\n" << vklog.abort();
-  }
 
-  vkDestroyFence(vk->device, fence, nullptr);
+const FrameStats &Application::get_frame_stats() const noexcept {
+  return state.last_frame_stats;
 }
 
 } // namespace app
@@ -12,10 +12,26 @@
 namespace vulkan {
 
 
+// what went into a frame besides its draw calls: the transfers recorded into
+// it, and the device memory allocated since the frame before.
+struct FrameStats {
+  u32 transfers = 0;
+  u32 allocations = 0;
+};
+
 struct FrameRenderState {
   bool rebuild_swapchain = true;
   u32 current_frame_index = 0;
-  static std::vector<std::vector<VkCommandBuffer>> allocated_command_buffers;
+  // submitted frames are numbered from 1: this is the next one's number.
+  u64 frame_number = 1;
+  // every frame up to this one has finished on the GPU.
+  u64 completed_frame = 0;
+  // the frame last submitted with each swapchain image's fence.
+  std::vector<u64> submitted_frames;
+  // recorded into the next frame's command buffer, ahead of its render pass.
+  std::vector<std::function<void(VkCommandBuffer)>> transfers;
+  // counted since the last frame, and for the last frame.
+  FrameStats frame_stats, last_frame_stats;
   static std::vector<std::vector<std::function<void()>>> resource_free_queue;
 };
 
@@ -39,12 +55,25 @@ class Application {
 public:
   static Application &init(u32 width, u32 height, std::string_view name);
   static Application &get();
-  VkCommandBuffer get_command_buffer(bool begin);
-  void flush_cmd_buffer(VkCommandBuffer buffer);
   ~Application();
   void main_loop();
   void add_render_callback(std::unique_ptr<Layer> layer);
   void submit_resource_free(std::function<void()> &&func);
+  // records `record` into the command buffer of the next frame, ahead of its
+  // render pass, so uploads go with the frame instead of being waited on.
+  void record_transfer(std::function<void(VkCommandBuffer)> &&record);
+  // the number of the next frame to be submitted, which recorded transfers
+  // go with.
+  u64 get_frame_number() const noexcept;
+  // the last frame the GPU is known to have finished.
+  u64 get_completed_frame() const noexcept;
+  // how many submitted frames the GPU may still be working on.
+  u32 get_frames_in_flight() const noexcept;
+  // blocks until frame `number` has finished, if it was submitted.
+  void wait_for_frame(u64 number);
+  // counts a device memory allocation towards the next frame's stats.
+  void count_allocation() noexcept;
+  const FrameStats &get_frame_stats() const noexcept;
 
 
 
@@ -0,0 +1,372 @@
+#include "log.h"
+#include "random.h"
+#include "renderer.h"
+#include "types.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Microbenchmarks of the ray tracer: the intersection kernels, every
+// material's scatter, whole paths and a full frame, in both precisions. Every
+// benchmark is repeated and reported as the mean and variance of the time per
+// operation, so runs before and after a change can be compared.
+
+static utils::Log benchlog("bench");
+
+namespace {
+using namespace renderer;
+using namespace renderer::ray_tracer;
+
+struct Result {
+  std::string name;
+  std::string precision;
+  size_t size; // spheres or materials in the scene, or pixels for the frame
+  size_t ops;  // operations timed per repetition
+  std::string op; // what an operation is: a ray, a path, a scatter...
+  double ns_per_op;
+  double variance; // of `ns_per_op` across repetitions, in ns^2
+};
+
+class Bench {
+  size_t repetitions;
+  std::vector<Result> results;
+
+public:
+  explicit Bench(size_t repetitions) : repetitions(repetitions) {}
+
+  // times `run`, which performs `ops` operations of kind `op`, once to warm
+  // up and then `repetitions` times.
+  void measure(std::string name, std::string precision, size_t size,
+               size_t ops, std::string op, const std::function<void()> &run) {
+    run();
+    std::vector<double> samples;
+    for (size_t i = 0; i != repetitions; ++i) {
+      const auto start = std::chrono::steady_clock::now();
+      run();
+      const auto elapsed = std::chrono::duration<double, std::nano>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+      samples.push_back(elapsed / static_cast<double>(ops));
+    }
+    double mean = 0.0;
+    for (const auto sample : samples)
+      mean += sample;
+    mean /= static_cast<double>(samples.size());
+    double variance = 0.0;
+    for (const auto sample : samples)
+      variance += (sample - mean) * (sample - mean);
+    if (samples.size() > 1)
+      variance /= static_cast<double>(samples.size() - 1);
+    benchlog.info() << name << " (" << precision << ", " << size
+                    << "): " << mean << " ns/" << op << '\n';
+    results.push_back(Result{std::move(name), std::move(precision), size, ops,
+                             std::move(op), mean, variance});
+  }
+
+  void write_json(std::ostream &out) const {
+    out << "[\n";
+    for (size_t i = 0; i != results.size(); ++i) {
+      const auto &r = results[i];
+      out << "  {\"name\": \"" << r.name << "\", \"precision\": \""
+          << r.precision << "\", \"size\": " << r.size
+          << ", \"ops\": " << r.ops << ", \"op\": \"" << r.op
+          << "\", \"ns_per_op\": " << r.ns_per_op
+          << ", \"variance\": " << r.variance
+          << ", \"ops_per_second\": " << 1e9 / r.ns_per_op << '}'
+          << (i + 1 != results.size() ? "," : "") << '\n';
+    }
+    out << "]\n";
+  }
+
+  void write_csv(std::ostream &out) const {
+    out << "name,precision,size,ops,op,ns_per_op,variance,ops_per_second\n";
+    for (const auto &r : results) {
+      out << r.name << ',' << r.precision << ',' << r.size << ',' << r.ops
+          << ',' << r.op << ',' << r.ns_per_op << ',' << r.variance << ','
+          << 1e9 / r.ns_per_op << '\n';
+    }
+  }
+};
+
+// every benchmark draws from this stream, so all runs see the same inputs.
+constexpr u64 SEED = 0x5eed;
+
+template <typename T> const char *precision_name() {
+  return std::is_same_v<T, float> ? "float" : "double";
+}
+
+template <typename T> vec3_t<T> random_direction(utils::random::Rng &rng) {
+  return vec3_t<T>(
+      unit_vector_from<double>({rng.next_double(), rng.next_double()}));
+}
+
+// rays from points around the scene towards random points inside it.
+template <typename T>
+std::vector<Ray<T>> random_rays(size_t count, double extent) {
+  auto rng = utils::random::Rng::for_sample(SEED, 1, 0);
+  std::vector<Ray<T>> rays(count);
+  for (auto &ray : rays) {
+    const auto origin = vec3_t<T>(random_direction<double>(rng) * extent * 1.5);
+    const auto target = vec3_t<T>((rng.next_double() - 0.5) * extent,
+                                  (rng.next_double() - 0.5) * extent,
+                                  (rng.next_double() - 0.5) * extent);
+    ray = Ray<T>{origin, glm::normalize(target - origin)};
+  }
+  return rays;
+}
+
+// primary rays of a `side` x `side` image looking into the scene from outside
+// it, laid out a block of `block` x `block` pixels after the other.
+template <typename T>
+std::vector<Ray<T>> camera_rays(size_t side, size_t block, double extent) {
+  std::vector<Ray<T>> rays;
+  rays.reserve(side * side);
+  const auto origin = vec3_t<T>(extent * 0.05, extent * 0.1, extent);
+  for (size_t block_y = 0; block_y < side; block_y += block) {
+    for (size_t block_x = 0; block_x < side; block_x += block) {
+      for (auto y = block_y; y != std::min(block_y + block, side); ++y) {
+        for (auto x = block_x; x != std::min(block_x + block, side); ++x) {
+          const auto direction = glm::normalize(
+              vec3((static_cast<double>(x) + 0.5) / side - 0.5,
+                   (static_cast<double>(y) + 0.5) / side - 0.5, -1.0));
+          rays.push_back(Ray<T>{origin, vec3_t<T>(direction)});
+        }
+      }
+    }
+  }
+  return rays;
+}
+
+// `count` spheres spread over a cube of side `extent`, with a mix of every
+// material kind.
+template <typename T> void random_scene(World<T> &world, size_t count,
+                                        double extent) {
+  auto rng = utils::random::Rng::for_sample(SEED, 2, 0);
+  const MaterialId materials[] = {
+      world.materials.add(Lambertian<T>{vec3_t<T>(0.7, 0.3, 0.2)}),
+      world.materials.add(Metal<T>(vec3_t<T>(0.8), T(0.2))),
+      world.materials.add(Dielectric<T>{T(1.5)})};
+  const auto radius = extent / std::cbrt(static_cast<double>(count)) * 0.3;
+  for (size_t i = 0; i != count; ++i) {
+    const auto center = vec3_t<T>((rng.next_double() - 0.5) * extent,
+                                  (rng.next_double() - 0.5) * extent,
+                                  (rng.next_double() - 0.5) * extent);
+    world.add(Sphere<T>{center, T(radius * (0.5 + rng.next_double()))},
+              materials[rng.next_u32() % 3]);
+  }
+  world.build_acceleration(1);
+}
+
+template <typename T> void bench_kernels(Bench &bench) {
+  const auto precision = precision_name<T>();
+  constexpr size_t RAYS = 1 << 16;
+  constexpr double EXTENT = 10.0;
+  const auto rays = random_rays<T>(RAYS, EXTENT);
+
+  {
+    const Sphere<T> sphere{vec3_t<T>(0), T(EXTENT * 0.25)};
+    size_t hits = 0;
+    bench.measure("sphere_intersect", precision, 1, RAYS, "ray", [&] {
+      Hit<T> hit;
+      for (const auto &ray : rays)
+        hits += sphere.intersect(ray, hit);
+    });
+    benchlog.debug() << hits << " hits\n";
+  }
+
+  for (const size_t count : {1, 16, 256, 4096, 65536, 1 << 20}) {
+    World<T> world;
+    random_scene(world, count, EXTENT);
+    size_t hits = 0;
+    bench.measure("world_intersect", precision, count, RAYS, "ray", [&] {
+      Hit<T> hit;
+      for (const auto &ray : rays)
+        hits += world.intersect(ray, hit);
+    });
+    benchlog.debug() << hits << " hits\n";
+  }
+
+  // coherent rays, one at a time and as packets of a block of pixels.
+  constexpr size_t SIDE = 256, BLOCK = 8;
+  const auto primary = camera_rays<T>(SIDE, BLOCK, EXTENT);
+  for (const size_t count : {256, 65536, 1 << 20}) {
+    World<T> world;
+    random_scene(world, count, EXTENT);
+    size_t hits = 0;
+    bench.measure("camera_intersect", precision, count, primary.size(),
+                  "ray", [&] {
+                    Hit<T> hit;
+                    for (const auto &ray : primary)
+                      hits += world.intersect(ray, hit);
+                  });
+    bench.measure("camera_packet_intersect", precision, count,
+                  primary.size(), "ray", [&] {
+                    Hit<T> packet_hits[BLOCK * BLOCK];
+                    for (size_t first = 0; first < primary.size();
+                         first += BLOCK * BLOCK) {
+                      const RayPacket<T> packet(
+                          std::span<const Ray<T>>(primary).subspan(
+                              first, BLOCK * BLOCK));
+                      hits += static_cast<size_t>(std::popcount(
+                          world.intersect(packet, packet_hits)));
+                    }
+                  });
+    benchlog.debug() << hits << " hits\n";
+  }
+
+  World<T> world;
+  random_scene(world, 4096, EXTENT);
+  // hits on every kind of material, to scatter from.
+  std::vector<std::pair<Ray<T>, Hit<T>>> hits;
+  for (const auto &ray : rays) {
+    Hit<T> hit;
+    if (world.intersect(ray, hit))
+      hits.emplace_back(ray, hit);
+  }
+  const char *names[] = {"scatter_lambertian", "scatter_metal",
+                         "scatter_dielectric"};
+  static_assert(std::size(names) == Materials<T>::KIND_COUNT,
+                "every material kind needs a scatter benchmark name");
+  for (u32 kind = 0; kind != Materials<T>::KIND_COUNT; ++kind) {
+    std::vector<std::pair<Ray<T>, Hit<T>>> of_kind;
+    for (auto [ray, hit] : hits) {
+      hit.material = MaterialId::make(kind, 0).value;
+      of_kind.emplace_back(ray, hit);
+    }
+    vec3_t<T> sink(0);
+    bench.measure(names[kind], precision, 1, of_kind.size(), "scatter",
+                  [&] {
+                    Sampler sampler(SamplerKind::Random, SEED, 0, 0, 1);
+                    for (const auto &[ray, hit] : of_kind) {
+                      sink += world.materials
+                                  .scatter(MaterialId{hit.material},
+                                           ray.direction, hit, sampler)
+                                  .second;
+                    }
+                  });
+    benchlog.debug() << sink.x << '\n';
+  }
+
+  vec3_t<T> sink(0);
+  // a path is a camera ray and every bounce after it.
+  bench.measure("ray_color", precision, 4096, RAYS, "path", [&] {
+    for (size_t i = 0; i != rays.size(); ++i) {
+      Sampler sampler(SamplerKind::Sobol, SEED, i, 0, 1);
+      sink += ray_color(rays[i], world, 50, sampler);
+    }
+  });
+  benchlog.debug() << sink.x << '\n';
+}
+
+void bench_frame(Bench &bench, size_t thread_count) {
+  constexpr size_t WIDTH = 320, HEIGHT = 240, SAMPLES = 16;
+  MainRenderThread renderer(thread_count);
+  for (const auto precision : {Precision::Double, Precision::Float}) {
+    for (const auto integrator :
+         {IntegratorKind::Path, IntegratorKind::Packet,
+          IntegratorKind::Wavefront}) {
+      RenderSettings settings;
+      settings.samples_per_pixel = SAMPLES;
+      settings.samples_per_pass = SAMPLES;
+      // fixed work: every pixel takes every sample.
+      settings.noise_threshold = 0.0;
+      settings.seed = SEED;
+      settings.precision = precision;
+      settings.integrator = integrator;
+      renderer.set_settings(settings);
+      bench.measure(std::string("frame_") +
+                        std::string(to_string(integrator)),
+                    precision == Precision::Float ? "float" : "double",
+                    WIDTH * HEIGHT, WIDTH * HEIGHT * SAMPLES, "sample", [&] {
+                      renderer.on_resize(WIDTH, HEIGHT);
+                      renderer.wait();
+                    });
+    }
+  }
+}
+
+bool parse_size(std::string_view text, size_t &out) {
+  const auto [ptr, err] =
+      std::from_chars(text.data(), text.data() + text.size(), out);
+  return err == std::errc() && ptr == text.data() + text.size() && out != 0;
+}
+
+void print_usage(const char *program) {
+  std::cerr << "usage: " << program
+            << " [-r repetitions] [-t threads] [-F json|csv] [-o output]"
+               " [-k] [-v]\n"
+               "  -k  only the kernel benchmarks, skip the full frame\n";
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t repetitions = 10;
+  size_t thread_count = 0; // default_thread_count()
+  std::string_view format = "json";
+  std::string_view output;
+  bool frame = true;
+  utils::Log::set_level(utils::Log::Level::WARN);
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "-r" && has_value) {
+      if (!parse_size(argv[++i], repetitions)) {
+        benchlog.error() << "Invalid repetition count: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (arg == "-t" && has_value) {
+      if (!parse_size(argv[++i], thread_count)) {
+        benchlog.error() << "Invalid thread count: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (arg == "-F" && has_value) {
+      format = argv[++i];
+      if (format != "json" && format != "csv") {
+        benchlog.error() << "Unknown format: " << format << '\n';
+        return 1;
+      }
+    } else if (arg == "-o" && has_value) {
+      output = argv[++i];
+    } else if (arg == "-k") {
+      frame = false;
+    } else if (arg == "-v") {
+      utils::Log::set_level(utils::Log::Level::INFO);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  Bench bench(repetitions);
+  bench_kernels<double>(bench);
+  bench_kernels<float>(bench);
+  if (frame)
+    bench_frame(bench, thread_count);
+
+  std::ofstream file;
+  if (!output.empty()) {
+    file.open(std::string(output));
+    if (!file) {
+      benchlog.error() << "Could not open " << output << ": "
+                       << std::strerror(errno) << '\n';
+      return 1;
+    }
+  }
+  auto &out = output.empty() ? std::cout : file;
+  if (format == "csv")
+    bench.write_csv(out);
+  else
+    bench.write_json(out);
+  return 0;
+}
@@ -0,0 +1,233 @@
+#include "image_io.h"
+#include "log.h"
+#include "renderer.h"
+#include "types.h"
+#include <charconv>
+#include <cstring>
+#include <optional>
+#include <string_view>
+
+// Offline entry point: renders a single frame without a window or a Vulkan
+// device and writes it to disk.
+
+static utils::Log headlesslog("headless");
+
+static void print_usage(const char *program) {
+  std::cerr << "usage: " << program
+            << " [-i scene | -g layout[:count[:seed]]] [-C output scene]"
+               " [-B output cache] [-V]"
+               " [-w width] [-h height]"
+               " [-t threads] [-s samples]"
+               " [-p samples per pass] [-n noise threshold]"
+               " [-S random|stratified|halton|sobol]"
+               " [-I path|packet|wavefront]"
+               " [-f] [-o output.ppm] [-q]\n"
+               "  -g  generate a scene instead of reading one: weekend, "
+               "uniform or clustered,\n"
+               "      e.g. -g weekend:1000000\n"
+               "  -C  convert the scene given with -i or -g to the binary "
+               "form instead of rendering\n"
+               "  -B  write the scene given with -i or -g as a scene cache, "
+               "with its BVHs built, instead of rendering\n"
+               "  -V  check every index in the scene cache given with -i, "
+               "reading it whole, instead of rendering\n";
+}
+
+static bool parse_size(std::string_view text, size_t &out) {
+  const auto [ptr, err] =
+      std::from_chars(text.data(), text.data() + text.size(), out);
+  return err == std::errc() && ptr == text.data() + text.size() && out != 0;
+}
+
+// generates the scene `-g` asked for and builds its acceleration structures.
+static renderer::ray_tracer::Scene
+generate(const renderer::ray_tracer::GeneratorSettings &generator,
+         size_t thread_count) {
+  renderer::Timer timer;
+  renderer::ray_tracer::Scene scene;
+  renderer::ray_tracer::SceneLoader loader(scene);
+  renderer::ray_tracer::generate_scene(generator, loader, thread_count);
+  const auto generate_ms = timer.millis();
+  scene.build_acceleration(thread_count);
+  headlesslog.info() << "Generated " << scene.world.spheres.size()
+                     << " spheres in " << generate_ms
+                     << "ms, built the BVHs in " << timer.millis() - generate_ms
+                     << "ms\n";
+  return scene;
+}
+
+int main(int argc, char **argv) {
+  size_t width = 800, height = 600;
+  size_t thread_count = 0; // default_thread_count()
+  renderer::RenderSettings settings;
+  // nobody looks at the intermediate images here, so take every sample in one
+  // pass unless asked otherwise.
+  size_t samples_per_pass = 0;
+  std::string_view output = "render.ppm";
+  std::string_view scene_path;
+  std::string_view convert_path;
+  std::string_view cache_path;
+  bool verify = false;
+  std::optional<renderer::ray_tracer::GeneratorSettings> generator;
+  utils::Log::set_level(utils::Log::Level::INFO);
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "-i" && has_value) {
+      scene_path = argv[++i];
+    } else if (arg == "-g" && has_value) {
+      generator = renderer::ray_tracer::parse_generator_settings(argv[++i]);
+      if (!generator) {
+        headlesslog.error() << "Invalid scene to generate: " << argv[i]
+                            << '\n';
+        return 1;
+      }
+    } else if (arg == "-C" && has_value) {
+      convert_path = argv[++i];
+    } else if (arg == "-B" && has_value) {
+      cache_path = argv[++i];
+    } else if (arg == "-V") {
+      verify = true;
+    } else if (arg == "-w" && has_value) {
+      if (!parse_size(argv[++i], width)) {
+        headlesslog.error() << "Invalid width: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (arg == "-h" && has_value) {
+      if (!parse_size(argv[++i], height)) {
+        headlesslog.error() << "Invalid height: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (arg == "-t" && has_value) {
+      if (!parse_size(argv[++i], thread_count)) {
+        headlesslog.error() << "Invalid thread count: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (arg == "-s" && has_value) {
+      if (!parse_size(argv[++i], settings.samples_per_pixel)) {
+        headlesslog.error() << "Invalid sample count: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (arg == "-p" && has_value) {
+      if (!parse_size(argv[++i], samples_per_pass)) {
+        headlesslog.error() << "Invalid samples per pass: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (arg == "-n" && has_value) {
+      const std::string_view text = argv[++i];
+      const auto [ptr, err] = std::from_chars(
+          text.data(), text.data() + text.size(), settings.noise_threshold);
+      if (err != std::errc() || ptr != text.data() + text.size()) {
+        headlesslog.error() << "Invalid noise threshold: " << text << '\n';
+        return 1;
+      }
+    } else if (arg == "-S" && has_value) {
+      const auto kind = renderer::ray_tracer::parse_sampler_kind(argv[++i]);
+      if (!kind) {
+        headlesslog.error() << "Unknown sampler: " << argv[i] << '\n';
+        return 1;
+      }
+      settings.sampler = *kind;
+    } else if (arg == "-I" && has_value) {
+      const auto kind =
+          renderer::ray_tracer::parse_integrator_kind(argv[++i]);
+      if (!kind) {
+        headlesslog.error() << "Unknown integrator: " << argv[i] << '\n';
+        return 1;
+      }
+      settings.integrator = *kind;
+    } else if (arg == "-f") {
+      settings.precision = renderer::Precision::Float;
+    } else if (arg == "-o" && has_value) {
+      output = argv[++i];
+    } else if (arg == "-q") {
+      utils::Log::set_level(utils::Log::Level::WARN);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (generator && !scene_path.empty()) {
+    headlesslog.error() << "-i and -g can't be used together\n";
+    return 1;
+  }
+  if (thread_count == 0)
+    thread_count = renderer::default_thread_count();
+
+  if (!convert_path.empty()) {
+    if (scene_path.empty() && !generator) {
+      headlesslog.error() << "-C needs a scene to convert (-i or -g)\n";
+      return 1;
+    }
+    renderer::ray_tracer::BinarySceneWriter writer(convert_path);
+    if (!writer.is_open())
+      return 1;
+    if (generator)
+      renderer::ray_tracer::generate_scene(*generator, writer, thread_count);
+    else if (!renderer::ray_tracer::read_scene(scene_path, writer,
+                                               thread_count))
+      return 1;
+    if (!writer.finish())
+      return 1;
+    headlesslog.ok() << "Wrote " << convert_path << '\n';
+    return 0;
+  }
+
+  if (!cache_path.empty()) {
+    renderer::ray_tracer::Scene scene;
+    if (generator)
+      scene = generate(*generator, thread_count);
+    if ((!generator &&
+         (scene_path.empty() ||
+          !renderer::ray_tracer::load_scene(scene_path, scene,
+                                            thread_count))) ||
+        !renderer::ray_tracer::write_scene_cache(cache_path, scene)) {
+      headlesslog.error() << "Could not build a scene cache\n";
+      return 1;
+    }
+    headlesslog.ok() << "Wrote " << cache_path << '\n';
+    return 0;
+  }
+
+  if (verify) {
+    if (scene_path.empty() ||
+        !renderer::ray_tracer::is_scene_cache(scene_path)) {
+      headlesslog.error() << "-V needs a scene cache to check (-i)\n";
+      return 1;
+    }
+    renderer::ray_tracer::Scene scene;
+    if (!renderer::ray_tracer::map_scene_cache(scene_path, scene, true))
+      return 1;
+    headlesslog.ok() << scene_path << " is intact\n";
+    return 0;
+  }
+
+  renderer::MainRenderThread renderer(thread_count);
+  if (generator)
+    renderer.set_scene(generate(*generator, thread_count));
+  else if (!scene_path.empty() && !renderer.load_scene(scene_path))
+    return 1;
+  settings.samples_per_pass =
+      samples_per_pass ? samples_per_pass : settings.samples_per_pixel;
+  settings.max_samples_per_pixel = 4 * settings.samples_per_pixel;
+  renderer.set_settings(settings);
+  headlesslog.info() << "Rendering " << width << 'x' << height << " to "
+                     << output << '\n';
+  renderer.on_resize(width, height);
+  renderer.wait();
+
+  if (!renderer::io::write_ppm(output, renderer.get_data(), width, height))
+    return 1;
+  headlesslog.ok() << "Wrote " << output << " in "
+                   << renderer.get_last_render_time() << "ms\n";
+  const auto &stats = renderer.get_worker_stats();
+  for (size_t i = 0; i != stats.size(); ++i) {
+    headlesslog.info() << "worker " << i << ": busy " << stats[i].busy_ms
+                       << "ms, idle " << stats[i].idle_ms << "ms, "
+                       << stats[i].tiles << " tiles (" << stats[i].stolen_tiles
+                       << " stolen)\n";
+  }
+  return 0;
+}
@@ -3,6 +3,9 @@
 #include "instance.h"
 #include "vulkan_utils.h"
 #include "log.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 extern utils::Log vklog;
 
@@ -48,6 +51,7 @@ void Image::allocate_memory(u64 size) {
     alloc_info.memoryTypeIndex = find_memory_type(
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, req.memoryTypeBits);
     check_vkerror(vkAllocateMemory(vk.device, &alloc_info, nullptr, &memory));
+    Application::get().count_allocation();
     check_vkerror(vkBindImageMemory(vk.device, image, memory, 0));
   }
 
@@ -86,68 +90,72 @@ void Image::allocate_memory(u64 size) {
 
   descriptor_set = (VkDescriptorSet)ImGui_ImplVulkan_AddTexture(
       sampler, image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(vk.physical_device, &properties);
+  flush_alignment = std::max<VkDeviceSize>(
+      properties.limits.nonCoherentAtomSize, 1);
 }
 
-void Image::set_data(const void *data) {
-  const auto device = Instance::get().device;
-  const size_t upload_size = width * height * 4 * 1 /* bytes per channel */;
-
-  if (!staging_buffer) {
-    // create upload buffer
-    VkBufferCreateInfo buffer_info = {};
-    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    buffer_info.size = upload_size;
-    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    if (vkCreateBuffer(device, &buffer_info, nullptr, &staging_buffer) < 0) {
-      vklog.error() << "Could not create staging buffer\n" << vklog.abort();
-    }
-    VkMemoryRequirements req;
-    vkGetBufferMemoryRequirements(device, staging_buffer, &req);
-    aligned_size = req.size;
-    VkMemoryAllocateInfo alloc_info = {};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = req.size;
+void Image::create_host_buffer(HostBuffer &out, VkDeviceSize size) {
+  const auto &vk = Instance::get();
+  VkBufferCreateInfo buffer_info = {};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = size;
+  buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (vkCreateBuffer(vk.device, &buffer_info, nullptr, &out.buffer) < 0) {
+    vklog.error() << "Could not create staging buffer\n" << vklog.abort();
+  }
+  VkMemoryRequirements req;
+  vkGetBufferMemoryRequirements(vk.device, out.buffer, &req);
+  out.memory_size = req.size;
+  VkMemoryAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.allocationSize = req.size;
+  // coherent memory is preferred: its flushes cost nothing.
+  alloc_info.memoryTypeIndex =
+      find_memory_type(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                       req.memoryTypeBits);
+  if (alloc_info.memoryTypeIndex == 0xffffffff)
     alloc_info.memoryTypeIndex = find_memory_type(
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, req.memoryTypeBits);
-    if (vkAllocateMemory(device, &alloc_info, nullptr, &staging_buffer_memory) <
-        0) {
-      vklog.error() << "Could not allocate memory for staging buffer\n"
-                    << vklog.abort();
-    }
-    if (vkBindBufferMemory(device, staging_buffer, staging_buffer_memory, 0) <
-        0) {
-      vklog.error() << "Could not bind buffer memory for staging buffer\n"
-                    << vklog.abort();
-    }
+  if (vkAllocateMemory(vk.device, &alloc_info, nullptr, &out.memory) < 0) {
+    vklog.error() << "Could not allocate memory for staging buffer\n"
+                  << vklog.abort();
   }
-
-  // upload to buffer
-  {
-    void *map = NULL;
-    if (vkMapMemory(device, staging_buffer_memory, 0, aligned_size, 0, &map) <
-        0) {
-      vklog.error() << "Could not map staging buffer memory to local buffer\n"
-                    << vklog.abort();
-    }
-    memcpy(map, data, upload_size);
-    VkMappedMemoryRange range[1] = {};
-    range[0].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    range[0].memory = staging_buffer_memory;
-    range[0].size = aligned_size;
-    if (vkFlushMappedMemoryRanges(device, 1, range) < 0) {
-      vklog.error() << "Could not flush memory to GPU\n" << vklog.abort();
-    }
-    vkUnmapMemory(device, staging_buffer_memory);
+  Application::get().count_allocation();
+  if (vkBindBufferMemory(vk.device, out.buffer, out.memory, 0) < 0) {
+    vklog.error() << "Could not bind buffer memory for staging buffer\n"
+                  << vklog.abort();
   }
+  // freeing the memory unmaps it.
+  void *map = NULL;
+  if (vkMapMemory(vk.device, out.memory, 0, out.memory_size, 0, &map) < 0) {
+    vklog.error() << "Could not map staging buffer memory to local buffer\n"
+                  << vklog.abort();
+  }
+  out.map = static_cast<u8 *>(map);
+}
 
-  // copy to imge
-  {
-    VkCommandBuffer cmd = Application::get().get_command_buffer(true);
+struct Image::Upload {
+  u64 frame;
+  VkImage image;
+  VkBuffer source;
+  // whether the image holds an earlier upload, which the copies keep.
+  bool has_contents;
+  std::vector<VkBufferImageCopy> copies;
 
+  void record(VkCommandBuffer cmd) const {
+    // partial uploads keep what the image already holds, so it can't be
+    // discarded by a transition from an undefined layout.
     VkImageMemoryBarrier copy_barrier = {};
     copy_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     copy_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    copy_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    copy_barrier.oldLayout = has_contents
+                                 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                 : VK_IMAGE_LAYOUT_UNDEFINED;
     copy_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
     copy_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     copy_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -155,18 +163,15 @@ void Image::set_data(const void *data) {
     copy_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     copy_barrier.subresourceRange.levelCount = 1;
     copy_barrier.subresourceRange.layerCount = 1;
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_HOST_BIT,
+    vkCmdPipelineBarrier(cmd,
+                         has_contents ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+                                      : VK_PIPELINE_STAGE_HOST_BIT,
                          VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
                          &copy_barrier);
 
-    VkBufferImageCopy region = {};
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.layerCount = 1;
-    region.imageExtent.width = width;
-    region.imageExtent.height = height;
-    region.imageExtent.depth = 1;
-    vkCmdCopyBufferToImage(cmd, staging_buffer, image,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    vkCmdCopyBufferToImage(cmd, source, image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<u32>(copies.size()), copies.data());
 
     VkImageMemoryBarrier use_barrier = {};
     use_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -183,9 +188,136 @@ void Image::set_data(const void *data) {
     vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
                          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0,
                          NULL, 1, &use_barrier);
+  }
+};
+
+static constexpr size_t PIXEL_SIZE = 4 * 1 /* bytes per channel */;
+
+void Image::set_data(const void *data) {
+  const Region whole{0, 0, width, height};
+  set_data(data, std::span(&whole, 1));
+}
+
+void Image::set_data(const void *data, std::span<const Region> regions) {
+  auto &app = Application::get();
+  if (!staging.buffer) {
+    // slots start at multiples of the flush alignment, like the ranges
+    // flushed.
+    const size_t upload_size = width * height * PIXEL_SIZE;
+    slot_size =
+        (upload_size + flush_alignment - 1) / flush_alignment * flush_alignment;
+    // a frame waits for the one submitted `frames in flight` before it, so
+    // one more slot than that is always free.
+    slot_frames.assign(app.get_frames_in_flight() + 1, 0);
+    create_host_buffer(staging, slot_size * slot_frames.size());
+  }
+
+  // the slot of the next frame. Only falling further behind than the ring
+  // allows for makes this wait.
+  const auto frame = app.get_frame_number();
+  const auto slot = frame % slot_frames.size();
+  if (slot_frames[slot] != frame) {
+    app.wait_for_frame(slot_frames[slot]);
+    slot_frames[slot] = frame;
+  }
+  upload(staging, slot * slot_size, data, regions);
+}
+
+u32 *Image::get_target() {
+  // plain memory: host-visible memory may be uncached, and uploads read it.
+  if (target.empty())
+    target.resize(size_t(width) * height);
+  return target.data();
+}
+
+void Image::upload(std::span<const Region> regions) {
+  set_data(get_target(), regions);
+}
+
+void Image::upload(const HostBuffer &source, VkDeviceSize base,
+                   const void *data, std::span<const Region> regions) {
+  // `source` is laid out like the image, so every region is at the same
+  // offset in both.
+  const Region whole{0, 0, width, height};
+  if (!has_contents)
+    regions = std::span(&whole, 1);
+  std::vector<VkBufferImageCopy> copies;
+  std::vector<VkMappedMemoryRange> flushes;
+  copies.reserve(regions.size());
+  flushes.reserve(regions.size());
+  for (auto region : regions) {
+    region.x = std::min(region.x, width);
+    region.y = std::min(region.y, height);
+    region.width = std::min(region.width, width - region.x);
+    region.height = std::min(region.height, height - region.y);
+    if (region.width == 0 || region.height == 0)
+      continue;
+    const auto offset = (size_t(region.y) * width + region.x) * PIXEL_SIZE;
+    VkBufferImageCopy copy = {};
+    copy.bufferOffset = base + offset;
+    copy.bufferRowLength = width;
+    copy.bufferImageHeight = height;
+    copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy.imageSubresource.layerCount = 1;
+    copy.imageOffset.x = static_cast<int32_t>(region.x);
+    copy.imageOffset.y = static_cast<int32_t>(region.y);
+    copy.imageExtent.width = region.width;
+    copy.imageExtent.height = region.height;
+    copy.imageExtent.depth = 1;
+    copies.push_back(copy);
+
+    // whole rows, widened to what the flush needs.
+    const VkDeviceSize first = base + size_t(region.y) * width * PIXEL_SIZE;
+    const VkDeviceSize last =
+        base + size_t(region.y + region.height) * width * PIXEL_SIZE;
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = source.memory;
+    range.offset = first / flush_alignment * flush_alignment;
+    const auto end =
+        (last + flush_alignment - 1) / flush_alignment * flush_alignment;
+    range.size =
+        end >= source.memory_size ? VK_WHOLE_SIZE : end - range.offset;
+    flushes.push_back(range);
+  }
+  if (copies.empty())
+    return;
+
+  if (data) {
+    for (const auto &copy : copies) {
+      const auto row_size = copy.imageExtent.width * PIXEL_SIZE;
+      const auto pitch = width * PIXEL_SIZE;
+      auto *to = source.map + copy.bufferOffset;
+      const auto *from =
+          static_cast<const u8 *>(data) + (copy.bufferOffset - base);
+      if (row_size == pitch) {
+        memcpy(to, from, pitch * copy.imageExtent.height);
+        continue;
+      }
+      for (u32 row = 0; row != copy.imageExtent.height;
+           ++row, to += pitch, from += pitch)
+        memcpy(to, from, row_size);
+    }
+  }
+  if (vkFlushMappedMemoryRanges(Instance::get().device,
+                                static_cast<u32>(flushes.size()),
+                                flushes.data()) < 0) {
+    vklog.error() << "Could not flush memory to GPU\n" << vklog.abort();
+  }
 
-    Application::get().flush_cmd_buffer(cmd);
+  // copy to image with the next frame. Uploads from the same buffer before
+  // it's submitted add their copies to the same recording.
+  auto &app = Application::get();
+  const auto frame = app.get_frame_number();
+  if (!pending || pending->frame != frame ||
+      pending->source != source.buffer) {
+    pending = std::make_shared<Upload>(
+        Upload{frame, image, source.buffer, has_contents, {}});
+    app.record_transfer(
+        [upload = pending](VkCommandBuffer cmd) { upload->record(cmd); });
   }
+  pending->copies.insert(pending->copies.end(), copies.begin(), copies.end());
+  has_contents = true;
 }
 
 Image::Image(u32 width, u32 height, const void *data)
@@ -203,15 +335,14 @@ u32 Image::get_height() const noexcept { return height; }
 Image::~Image() {
   Application::get().submit_resource_free(
       [sampler = sampler, image_view = image_view, image = image,
-       memory = memory, staging_buffer = staging_buffer,
-       staging_buffer_memory = staging_buffer_memory]() {
+       memory = memory, staging = staging]() {
         const auto device = Instance::get().device;
         vkDestroySampler(device, sampler, nullptr);
         vkDestroyImageView(device, image_view, nullptr);
         vkDestroyImage(device, image, nullptr);
         vkFreeMemory(device, memory, nullptr);
-        vkDestroyBuffer(device, staging_buffer, nullptr);
-        vkFreeMemory(device, staging_buffer_memory, nullptr);
+        vkDestroyBuffer(device, staging.buffer, nullptr);
+        vkFreeMemory(device, staging.memory, nullptr);
       });
 }
 
@@ -1,25 +1,77 @@
 #pragma once
 #include "types.h"
+#include <memory>
+#include <span>
+#include <vector>
 #include <vulkan/vulkan.h>
 
 namespace vulkan::utils {
 // RGBA image.
 class Image {
+public:
+  // a rectangle of the image, in pixels.
+  struct Region {
+    u32 x, y, width, height;
+  };
+
+private:
   u32 width, height;
   VkImage image = nullptr;
   VkDescriptorSet descriptor_set = nullptr;
-  VkDeviceMemory memory = nullptr, staging_buffer_memory = nullptr;
+  VkDeviceMemory memory = nullptr;
   VkSampler sampler = nullptr;
-  VkBuffer staging_buffer = nullptr;
   VkImageView image_view = nullptr;
-  VkDeviceSize aligned_size = 0;
+  // flushed ranges of host buffers must be multiples of this.
+  VkDeviceSize flush_alignment = 1;
+
+  // a host-visible buffer, mapped while the image lives.
+  struct HostBuffer {
+    VkBuffer buffer = nullptr;
+    VkDeviceMemory memory = nullptr;
+    VkDeviceSize memory_size = 0;
+    u8 *map = nullptr;
+  };
+  // a ring of slots, each laid out like the image and written by the
+  // uploads of one frame, so a frame never overwrites what one still in
+  // flight copies from.
+  HostBuffer staging;
+  VkDeviceSize slot_size = 0;
+  // the frame that last wrote each slot.
+  std::vector<u64> slot_frames;
+  // the back buffer, written in place by the renderer. Frames only copy from
+  // the staging slots, so writes never race with them.
+  std::vector<u32> target;
+  // the copies to record into the next frame, shared with the recording.
+  struct Upload;
+  std::shared_ptr<Upload> pending;
+  // whether the image holds an upload yet. Until it does, only whole uploads
+  // are possible: the rest of the image would be undefined.
+  bool has_contents = false;
 
   void allocate_memory(u64 size);
+  void create_host_buffer(HostBuffer &out, VkDeviceSize size);
+  // copies `regions` from `source`, laid out like the image from `base`, with
+  // the next frame. `data`, if not null, is written to `source` first.
+  void upload(const HostBuffer &source, VkDeviceSize base, const void *data,
+              std::span<const Region> regions);
 
 public:
   Image(u32 width, u32 height, const void *data);
   ~Image();
+  // uploads the whole image from `data`, `width * height` RGBA pixels.
   void set_data(const void *data);
+  // uploads only `regions` of `data`, which still holds the whole image, with
+  // one copy per region. Regions are clipped to the image. Uploads the whole
+  // image the first time. `data` is copied right away, and the copies to the
+  // image are recorded into the next frame: nothing waits for them.
+  void set_data(const void *data, std::span<const Region> regions);
+  // the pixels of the image, to be written in place: a back buffer the size
+  // of the image. Writes may go on during `upload`; it sees either the old or
+  // the new pixel, and the next upload of the region catches up.
+  u32 *get_target();
+  // uploads `regions` of the target as `set_data` would: only they are
+  // copied, into the staging slot of the next frame.
+  void upload(std::span<const Region> regions);
   VkDescriptorSet get_descriptor_set() const noexcept;
   u32 get_width() const noexcept;
   u32 get_height() const noexcept;
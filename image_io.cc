@@ -0,0 +1,76 @@
+#include "image_io.h"
+#include "log.h"
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+static utils::Log iolog("io");
+
+namespace renderer::io {
+
+bool write_ppm(std::string_view path, const u32 *data, size_t width,
+               size_t height) {
+  std::ofstream file(std::string(path), std::ios::binary);
+  if (!file) {
+    iolog.error() << "Could not open " << path << " for writing\n";
+    return false;
+  }
+  file << "P6\n" << width << ' ' << height << "\n255\n";
+
+  // PPM is RGB without alpha, so strip it row by row.
+  std::vector<char> row(width * 3);
+  for (size_t y = 0; y != height; ++y) {
+    for (size_t x = 0; x != width; ++x) {
+      const auto pixel = data[y * width + x];
+      row[x * 3 + 0] = static_cast<char>(pixel & 0xff);
+      row[x * 3 + 1] = static_cast<char>((pixel >> 8) & 0xff);
+      row[x * 3 + 2] = static_cast<char>((pixel >> 16) & 0xff);
+    }
+    file.write(row.data(), row.size());
+  }
+
+  if (!file) {
+    iolog.error() << "Could not write image to " << path << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool read_ppm(std::string_view path, std::vector<u32> &data, size_t &width,
+              size_t &height) {
+  std::ifstream file(std::string(path), std::ios::binary);
+  if (!file) {
+    iolog.error() << "Could not open " << path << " for reading\n";
+    return false;
+  }
+  // the header is whitespace separated and may have comments in between.
+  const auto next_field = [&](size_t &value) {
+    while (file >> std::ws && file.peek() == '#')
+      file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    return static_cast<bool>(file >> value);
+  };
+  std::string magic;
+  size_t max_value = 0;
+  if (!(file >> magic) || magic != "P6" || !next_field(width) ||
+      !next_field(height) || !next_field(max_value) || max_value != 255) {
+    iolog.error() << path << " is not an 8-bit binary PPM\n";
+    return false;
+  }
+  // exactly one whitespace character separates the header from the pixels.
+  file.get();
+
+  std::vector<char> rgb(width * height * 3);
+  if (!file.read(rgb.data(), static_cast<std::streamsize>(rgb.size()))) {
+    iolog.error() << path << " is truncated\n";
+    return false;
+  }
+  data.resize(width * height);
+  for (size_t i = 0; i != data.size(); ++i) {
+    data[i] = 0xffu << 24 | u32(u8(rgb[i * 3 + 2])) << 16 |
+              u32(u8(rgb[i * 3 + 1])) << 8 | u32(u8(rgb[i * 3]));
+  }
+  return true;
+}
+
+} // namespace renderer::io
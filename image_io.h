@@ -0,0 +1,18 @@
+#pragma once
+#include "types.h"
+#include <string_view>
+#include <vector>
+
+namespace renderer::io {
+
+// writes an ABGR (as produced by the renderer) buffer as a binary PPM.
+// Returns false and logs the error if the file couldn't be written.
+bool write_ppm(std::string_view path, const u32 *data, size_t width,
+               size_t height);
+
+// reads a binary PPM with 8-bit channels into ABGR pixels with opaque alpha.
+// Returns false and logs the error if the file is missing or malformed.
+bool read_ppm(std::string_view path, std::vector<u32> &data, size_t &width,
+              size_t &height);
+
+} // namespace renderer::io
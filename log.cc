@@ -20,6 +20,12 @@ std::osyncstream Log::info() {
   return std::move(std::osyncstream(static_cast<std::ostream&>(stream << "\x1b[38;5;6m[" << name << "::info]\x1b[m ")));
 }
 
+std::osyncstream Log::warn() {
+  if (s_level > Level::WARN)
+    return std::move(std::osyncstream(static_cast<std::ostream&>(sink)));
+  return std::move(std::osyncstream(static_cast<std::ostream&>(stream << "\x1b[38;5;3m[" << name << "::warn]\x1b[m ")));
+}
+
 std::osyncstream Log::error() {
   return std::move(std::osyncstream(static_cast<std::ostream&>(stream << "\x1b[38;5;1m[" << name << "::error]\x1b[m ")));
 }
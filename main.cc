@@ -8,7 +8,8 @@
 #include <functional>
 #include <glm/glm.hpp>
 #include <memory>
-#include <random>
+#include <utility>
+#include <vector>
 
 using vec3 = glm::highp_dvec3;
 
@@ -21,28 +22,103 @@ private:
   std::unique_ptr<vulkan::utils::Image> image = nullptr;
   u32 viewport_width = 0, viewport_height = 0;
   renderer::MainRenderThread renderer;
+  // reused from one frame to the next.
+  std::vector<renderer::Rect> dirty_rects;
+  std::vector<vulkan::utils::Image::Region> regions;
 
 public:
+  bool load_scene(std::string_view path) { return renderer.load_scene(path); }
+
   void on_ui_render() {
 
     ImGui::Begin("Settings");
+    {
+      auto settings = renderer.get_settings();
+      int samples_per_pixel = static_cast<int>(settings.samples_per_pixel);
+      int samples_per_pass = static_cast<int>(settings.samples_per_pass);
+      ImGui::SliderInt("Samples per pixel", &samples_per_pixel, 1, 1000);
+      ImGui::SliderInt("Samples per pass", &samples_per_pass, 1, 100);
+      float noise_threshold = static_cast<float>(settings.noise_threshold);
+      ImGui::SliderFloat("Noise threshold", &noise_threshold, 0.0f, 0.1f,
+                         "%.3f");
+      settings.noise_threshold = noise_threshold;
+      if (ImGui::BeginCombo("Sampler",
+                            renderer::ray_tracer::to_string(settings.sampler)
+                                .data())) {
+        using renderer::ray_tracer::SamplerKind;
+        for (const auto kind : {SamplerKind::Random, SamplerKind::Stratified,
+                                SamplerKind::Halton, SamplerKind::Sobol}) {
+          if (ImGui::Selectable(renderer::ray_tracer::to_string(kind).data(),
+                                kind == settings.sampler))
+            settings.sampler = kind;
+        }
+        ImGui::EndCombo();
+      }
+      if (ImGui::BeginCombo(
+              "Integrator",
+              renderer::ray_tracer::to_string(settings.integrator).data())) {
+        using renderer::ray_tracer::IntegratorKind;
+        for (const auto kind :
+             {IntegratorKind::Path, IntegratorKind::Packet,
+              IntegratorKind::Wavefront}) {
+          if (ImGui::Selectable(renderer::ray_tracer::to_string(kind).data(),
+                                kind == settings.integrator))
+            settings.integrator = kind;
+        }
+        ImGui::EndCombo();
+      }
+      bool single_precision = settings.precision == renderer::Precision::Float;
+      ImGui::Checkbox("Single precision", &single_precision);
+      settings.precision = single_precision ? renderer::Precision::Float
+                                            : renderer::Precision::Double;
+      settings.samples_per_pixel = static_cast<size_t>(samples_per_pixel);
+      settings.max_samples_per_pixel = 4 * settings.samples_per_pixel;
+      settings.samples_per_pass = static_cast<size_t>(samples_per_pass);
+      renderer.set_settings(settings);
+    }
     if (ImGui::Button("Render")) {
+      // the render in progress writes into the old image until `on_resize`
+      // stops it, so the old image has to outlive the call.
+      std::unique_ptr<vulkan::utils::Image> previous;
       if (!image || viewport_width != image->get_width() ||
           viewport_height != image->get_height()) {
         renderlog.info() << "Viewport resized to " << viewport_width << 'x'
                          << viewport_height << '\n';
         // reallocate image
-        image = std::make_unique<vulkan::utils::Image>(
-            viewport_width, viewport_height, nullptr);
+        previous = std::exchange(image, std::make_unique<vulkan::utils::Image>(
+                                            viewport_width, viewport_height,
+                                            nullptr));
       }
-      renderer.on_resize(viewport_width, viewport_height);
-      image->set_data(renderer.get_data());
+      // the renderer writes straight into the image's back buffer. Every
+      // tile counts as changed, so the next update uploads it all.
+      renderer.on_resize(viewport_width, viewport_height,
+                         image->get_target());
+    }
+    ImGui::Text("Last render: %.3fms", renderer.get_last_render_time());
+    if (ImGui::TreeNode("Workers")) {
+      const auto &stats = renderer.get_worker_stats();
+      for (size_t i = 0; i != stats.size(); ++i) {
+        ImGui::Text("%zu: busy %.1fms, idle %.1fms (%zu tiles, %zu stolen)", i,
+                    stats[i].busy_ms, stats[i].idle_ms, stats[i].tiles,
+                    stats[i].stolen_tiles);
+      }
+      ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Frame")) {
+      const auto &stats = vulkan::Application::get().get_frame_stats();
+      ImGui::Text("%u transfers, %u allocations", stats.transfers,
+                  stats.allocations);
+      ImGui::TreePop();
     }
     ImGui::End();
 
-    // update the image
+    // update the image: only the tiles finished since the last frame.
     if (renderer.on_frame_update()) {
-      image->set_data(renderer.get_data());
+      renderer.take_dirty_rects(dirty_rects);
+      regions.clear();
+      for (const auto &rect : dirty_rects)
+        regions.push_back({rect.x, rect.y, rect.width, rect.height});
+      image->upload(regions);
     }
 
     // remove ugly border
@@ -65,10 +141,14 @@ std::ostream &operator<<(std::ostream &s, const vec3 &v) {
   return s << '[' << v.x << ' ' << v.y << ' ' << v.z << ']';
 }
 
-int main() {
+// takes an optional scene file to render instead of the built-in scene.
+int main(int argc, char **argv) {
 
   utils::Log::set_level(utils::Log::Level::DEBUG);
+  auto layer = std::make_unique<RendererLayer>();
+  if (argc > 1 && !layer->load_scene(argv[1]))
+    return 1;
   auto &app = vulkan::Application::init(800, 600, "test");
-  app.add_render_callback(std::make_unique<RendererLayer>());
+  app.add_render_callback(std::move(layer));
   app.main_loop();
 }
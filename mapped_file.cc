@@ -0,0 +1,96 @@
+#include "mapped_file.h"
+#include <cerrno>
+#include <fstream>
+#include <string>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace utils {
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : address(std::exchange(other.address, nullptr)),
+      length(std::exchange(other.length, 0)),
+      mapped(std::exchange(other.mapped, false)),
+      contents(std::move(other.contents)) {}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+  if (this != &other) {
+    close();
+    address = std::exchange(other.address, nullptr);
+    length = std::exchange(other.length, 0);
+    mapped = std::exchange(other.mapped, false);
+    contents = std::move(other.contents);
+  }
+  return *this;
+}
+
+MappedFile::~MappedFile() { close(); }
+
+void MappedFile::close() noexcept {
+#if defined(__unix__) || defined(__APPLE__)
+  if (mapped)
+    munmap(const_cast<std::byte *>(address), length);
+#endif
+  address = nullptr;
+  length = 0;
+  mapped = false;
+  contents = {};
+}
+
+bool MappedFile::open(std::string_view path) {
+  close();
+#if defined(__unix__) || defined(__APPLE__)
+  const auto fd = ::open(std::string(path).c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    const auto error = errno;
+    ::close(fd);
+    errno = error;
+    return false;
+  }
+  if (status.st_size == 0) {
+    ::close(fd);
+    errno = EINVAL;
+    return false;
+  }
+  const auto size = static_cast<size_t>(status.st_size);
+  void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file alive on its own.
+  const auto error = errno;
+  ::close(fd);
+  if (memory == MAP_FAILED) {
+    errno = error;
+    return false;
+  }
+  address = static_cast<const std::byte *>(memory);
+  length = size;
+  mapped = true;
+  return true;
+#else
+  std::ifstream file(std::string(path), std::ios::binary | std::ios::ate);
+  if (!file)
+    return false;
+  contents.resize(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  if (contents.empty() ||
+      !file.read(reinterpret_cast<char *>(contents.data()),
+                 static_cast<std::streamsize>(contents.size()))) {
+    contents = {};
+    errno = EIO;
+    return false;
+  }
+  address = contents.data();
+  length = contents.size();
+  return true;
+#endif
+}
+
+} // namespace utils
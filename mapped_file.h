@@ -0,0 +1,38 @@
+#pragma once
+#include "aligned_vector.h"
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+namespace utils {
+
+// Read-only view of a whole file. Where the platform can map files, pages are
+// only read from disk when first touched; elsewhere the file is read up
+// front. Either way the bytes start on a 64 byte boundary.
+class MappedFile {
+  const std::byte *address = nullptr;
+  size_t length = 0;
+  bool mapped = false;
+  // holds the file where it can't be mapped.
+  alloc::aligned_vector<std::byte> contents;
+
+  void close() noexcept;
+
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile(MappedFile &&other) noexcept;
+  MappedFile &operator=(MappedFile &&other) noexcept;
+  ~MappedFile();
+
+  // replaces the current file, if any. Returns false with `errno` set on
+  // errors.
+  bool open(std::string_view path);
+  bool is_open() const noexcept { return address != nullptr; }
+  std::span<const std::byte> bytes() const noexcept {
+    return {address, length};
+  }
+};
+
+} // namespace utils
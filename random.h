@@ -0,0 +1,67 @@
+#pragma once
+#include "types.h"
+
+namespace utils::random {
+
+// SplitMix64's finaliser. Turns structured input (indices, counters) into
+// well-distributed bits.
+constexpr u64 mix(u64 x) noexcept {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+constexpr u64 hash(u64 a, u64 b) noexcept {
+  return mix(a ^ mix(b + 0x9e3779b97f4a7c15ull));
+}
+
+// PCG32 (XSH-RR). 16 bytes of state and no tables, so every sample can cheaply
+// get a generator of its own.
+class Rng {
+  u64 state;
+  u64 increment; // selects the stream, must be odd
+
+public:
+  constexpr Rng(u64 seed, u64 stream) noexcept
+      : state(0), increment((stream << 1u) | 1u) {
+    next_u32();
+    state += seed;
+    next_u32();
+  }
+
+  // generator for one sample of one pixel. What it produces only depends on
+  // its key, so renders are reproducible whatever the thread count or the
+  // order tiles are picked up in. Bounces draw from it in sequence.
+  static constexpr Rng for_sample(u64 seed, u64 pixel, u64 sample) noexcept {
+    // both depend on the sample: streams that start from the same state are
+    // correlated.
+    return Rng(hash(hash(seed, pixel), sample), hash(pixel, sample));
+  }
+
+  constexpr u32 next_u32() noexcept {
+    const auto old = state;
+    state = old * 6364136223846793005ull + increment;
+    const auto xorshifted = static_cast<u32>(((old >> 18u) ^ old) >> 27u);
+    const auto rotation = static_cast<u32>(old >> 59u);
+    return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+  }
+
+  constexpr u64 next_u64() noexcept {
+    return (u64(next_u32()) << 32) | next_u32();
+  }
+
+  // uniform in [0, 1).
+  constexpr float next_float() noexcept {
+    return static_cast<float>(next_u32() >> 8) * 0x1p-24f;
+  }
+
+  // uniform in [0, 1).
+  constexpr double next_double() noexcept {
+    return static_cast<double>(next_u64() >> 11) * 0x1p-53;
+  }
+};
+
+} // namespace utils::random
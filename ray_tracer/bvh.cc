@@ -0,0 +1,187 @@
+#include "ray_tracer/bvh.h"
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <thread>
+
+namespace renderer::ray_tracer {
+namespace {
+constexpr size_t BIN_COUNT = 16;
+// leaves may still be bigger than this if the primitives can't be told apart.
+constexpr size_t MAX_LEAF_SIZE = 8;
+// the traversal stack is fixed-size, so don't go deeper than it can hold.
+constexpr size_t MAX_DEPTH = 60;
+// cost of visiting a node, relative to intersecting a primitive.
+constexpr double TRAVERSAL_COST = 1.0;
+// subtrees smaller than this aren't worth spawning a thread for.
+constexpr size_t MIN_PARALLEL_PRIMITIVES = 4096;
+
+template <typename T> struct Split {
+  size_t axis;
+  size_t bin;
+  double cost = std::numeric_limits<double>::infinity();
+  T bin_start;
+  T bin_scale;
+  bool valid() const noexcept {
+    return cost != std::numeric_limits<double>::infinity();
+  }
+  size_t bin_of(const vec3_t<T> &centroid) const noexcept {
+    const auto b =
+        static_cast<size_t>((centroid[axis] - bin_start) * bin_scale);
+    return std::min(b, BIN_COUNT - 1);
+  }
+};
+
+template <typename T> class Builder {
+  using AABB = ray_tracer::AABB<T>;
+  using BVHNode = ray_tracer::BVHNode<T>;
+  using Split = ray_tracer::Split<T>;
+
+  std::span<const AABB> bounds;
+  std::vector<vec3_t<T>> centroids;
+  std::vector<u32> &indices;
+
+  Split find_split(u32 begin, u32 end, const AABB &centroid_bounds,
+                   double parent_area) const noexcept {
+    Split best;
+    for (size_t axis = 0; axis != 3; ++axis) {
+      const auto extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+      if (extent <= T(0))
+        continue;
+      Split candidate{axis, 0, best.cost, centroid_bounds.min[axis],
+                      T(BIN_COUNT) / extent};
+
+      std::array<AABB, BIN_COUNT> bin_bounds;
+      std::array<size_t, BIN_COUNT> bin_counts{};
+      for (auto i = begin; i != end; ++i) {
+        const auto primitive = indices[i];
+        const auto b = candidate.bin_of(centroids[primitive]);
+        bin_bounds[b].grow(bounds[primitive]);
+        ++bin_counts[b];
+      }
+
+      // sweep from the right so the left sweep can evaluate every plane.
+      std::array<double, BIN_COUNT> right_cost{};
+      AABB accumulated;
+      size_t accumulated_count = 0;
+      for (size_t b = BIN_COUNT - 1; b != 0; --b) {
+        accumulated.grow(bin_bounds[b]);
+        accumulated_count += bin_counts[b];
+        right_cost[b] =
+            static_cast<double>(accumulated.surface_area()) * accumulated_count;
+      }
+      accumulated = AABB{};
+      accumulated_count = 0;
+      for (size_t b = 1; b != BIN_COUNT; ++b) {
+        accumulated.grow(bin_bounds[b - 1]);
+        accumulated_count += bin_counts[b - 1];
+        if (accumulated_count == 0 || accumulated_count == end - begin)
+          continue;
+        const auto cost =
+            TRAVERSAL_COST +
+            (static_cast<double>(accumulated.surface_area()) *
+                 accumulated_count +
+             right_cost[b]) /
+                parent_area;
+        if (cost < best.cost) {
+          best = candidate;
+          best.bin = b;
+          best.cost = cost;
+        }
+      }
+    }
+    return best;
+  }
+
+  // appends the nodes of a subtree built separately, relocating its child
+  // links.
+  static void append(std::vector<BVHNode> &nodes,
+                     const std::vector<BVHNode> &subtree) {
+    const auto base = static_cast<u32>(nodes.size());
+    for (auto node : subtree) {
+      if (!node.is_leaf())
+        node.offset += base;
+      nodes.push_back(node);
+    }
+  }
+
+public:
+  Builder(std::span<const AABB> bounds, std::vector<u32> &indices)
+      : bounds(bounds), centroids(bounds.size()), indices(indices) {
+    for (size_t i = 0; i != bounds.size(); ++i)
+      centroids[i] = bounds[i].centroid();
+  }
+
+  void build(std::vector<BVHNode> &nodes, u32 begin, u32 end, size_t depth,
+             size_t thread_count) {
+    const auto node_index = nodes.size();
+    nodes.emplace_back();
+
+    AABB node_bounds, centroid_bounds;
+    for (auto i = begin; i != end; ++i) {
+      node_bounds.grow(bounds[indices[i]]);
+      centroid_bounds.grow(centroids[indices[i]]);
+    }
+    nodes[node_index].bounds = node_bounds;
+
+    const auto count = end - begin;
+    const auto make_leaf = [&] {
+      nodes[node_index].offset = begin;
+      nodes[node_index].count = count;
+    };
+    if (count <= 2 || depth >= MAX_DEPTH)
+      return make_leaf();
+
+    const auto split =
+        find_split(begin, end, centroid_bounds, node_bounds.surface_area());
+    // it's cheaper to test every primitive than to split.
+    if (!split.valid() ||
+        (split.cost >= static_cast<double>(count) && count <= MAX_LEAF_SIZE))
+      return make_leaf();
+
+    const auto middle = static_cast<u32>(
+        std::partition(indices.begin() + begin, indices.begin() + end,
+                       [&](u32 primitive) {
+                         return split.bin_of(centroids[primitive]) < split.bin;
+                       }) -
+        indices.begin());
+
+    if (thread_count > 1 && count >= MIN_PARALLEL_PRIMITIVES) {
+      std::vector<BVHNode> left, right;
+      std::thread left_builder([&, left_threads = thread_count / 2] {
+        build(left, begin, middle, depth + 1, left_threads);
+      });
+      build(right, middle, end, depth + 1, thread_count - thread_count / 2);
+      left_builder.join();
+      append(nodes, left);
+      nodes[node_index].offset = static_cast<u32>(nodes.size());
+      append(nodes, right);
+    } else {
+      build(nodes, begin, middle, depth + 1, 1);
+      nodes[node_index].offset = static_cast<u32>(nodes.size());
+      build(nodes, middle, end, depth + 1, 1);
+    }
+  }
+};
+} // namespace
+
+template <typename T>
+void BVH<T>::build(std::span<const AABB<T>> bounds, size_t thread_count) {
+  own_nodes.clear();
+  nodes = {};
+  indices.resize(bounds.size());
+  std::iota(indices.begin(), indices.end(), 0);
+  if (bounds.empty())
+    return;
+  // a binary tree has at most 2n - 1 nodes.
+  own_nodes.reserve(2 * bounds.size() - 1);
+  Builder<T>(bounds, indices)
+      .build(own_nodes, 0, static_cast<u32>(bounds.size()), 0,
+             std::max<size_t>(thread_count, 1));
+  nodes = own_nodes;
+}
+
+template class BVH<float>;
+template class BVH<double>;
+
+} // namespace renderer::ray_tracer
@@ -0,0 +1,334 @@
+#pragma once
+#include "ray_tracer/ray.h"
+#include "types.h"
+#include <algorithm>
+#include <limits>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace renderer::ray_tracer {
+
+template <typename T> struct AABB {
+  using vec3 = vec3_t<T>;
+  static constexpr T INF = std::numeric_limits<T>::infinity();
+
+  vec3 min = vec3(INF);
+  vec3 max = vec3(-INF);
+
+  void grow(const vec3 &point) noexcept {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+  void grow(const AABB &other) noexcept {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+  }
+  vec3 centroid() const noexcept { return (min + max) * T(0.5); }
+  T surface_area() const noexcept {
+    const auto e = max - min;
+    // empty boxes have negative extents.
+    if (e.x < T(0) || e.y < T(0) || e.z < T(0))
+      return T(0);
+    return T(2) * (e.x * e.y + e.y * e.z + e.z * e.x);
+  }
+
+  // slab test. `inv_direction` is 1 / ray.direction, precomputed once per
+  // ray. Returns the entry distance, or infinity if the box is missed or is
+  // farther than `t_max`.
+  T intersect(const Ray<T> &ray, const vec3 &inv_direction,
+              T t_max) const noexcept {
+    const auto t0 = (min - ray.origin) * inv_direction;
+    const auto t1 = (max - ray.origin) * inv_direction;
+    const auto tmin = glm::min(t0, t1);
+    const auto tmax = glm::max(t0, t1);
+    const auto enter =
+        std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, T(0)));
+    const auto exit =
+        std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, t_max));
+    return enter <= exit ? enter : INF;
+  }
+};
+
+// Up to `MAX_SIZE` rays traced through a BVH together, such as the camera
+// rays of a block of neighbouring pixels. Where every ray heads the same way
+// along every axis, the intervals of the rays' origins and inverse directions
+// bound all of their slab tests at once (Boulos et al., "Packet-based Whitted
+// and Distribution Ray Tracing"), so a node is culled for the whole packet
+// with a single test. Packets that diverge are traced a ray at a time.
+template <typename T> class RayPacket {
+public:
+  using vec3 = vec3_t<T>;
+  // one bit per ray.
+  using Mask = u64;
+  static constexpr size_t MAX_SIZE = 64;
+  static constexpr T INF = AABB<T>::INF;
+
+private:
+  // intervals over the packet, per axis.
+  vec3 origin_min = vec3(INF), origin_max = vec3(-INF);
+  vec3 inv_min = vec3(INF), inv_max = vec3(-INF);
+  // the box corner each ray enters through: 1 where the directions are
+  // negative.
+  int entry_corner[3] = {0, 0, 0};
+  bool is_coherent = true;
+
+public:
+  std::span<const Ray<T>> rays;
+  vec3 inv_directions[MAX_SIZE];
+
+  // `rays` must outlive the packet.
+  explicit RayPacket(std::span<const Ray<T>> rays) noexcept : rays(rays) {
+    for (size_t i = 0; i != rays.size(); ++i) {
+      const auto &ray = rays[i];
+      inv_directions[i] = T(1) / ray.direction;
+      origin_min = glm::min(origin_min, ray.origin);
+      origin_max = glm::max(origin_max, ray.origin);
+      inv_min = glm::min(inv_min, inv_directions[i]);
+      inv_max = glm::max(inv_max, inv_directions[i]);
+    }
+    for (int axis = 0; axis != 3; ++axis) {
+      // a direction of 0 (or -0) along the axis has an infinite inverse,
+      // which the intervals can't bound.
+      const auto first = rays.empty() ? T(1) : rays[0].direction[axis];
+      entry_corner[axis] = first < T(0);
+      for (const auto &ray : rays) {
+        const auto d = ray.direction[axis];
+        is_coherent &= first < T(0) ? d < T(0) : d > T(0);
+      }
+    }
+  }
+
+  size_t size() const noexcept { return rays.size(); }
+  Mask all() const noexcept {
+    return size() == MAX_SIZE ? ~Mask(0) : (Mask(1) << size()) - 1;
+  }
+  // whether the rays all head the same way along every axis, which the
+  // interval test needs.
+  bool coherent() const noexcept { return is_coherent; }
+
+  // a lower bound of the distances at which the rays enter `box`, or
+  // infinity if none of them can hit it nearer than `t_max`. Never culls a
+  // box `AABB::intersect` would report a hit on for one of the rays. Only
+  // meaningful for coherent packets.
+  T enter(const AABB<T> &box, T t_max) const noexcept {
+    T enter = T(0), exit = t_max;
+    for (int axis = 0; axis != 3; ++axis) {
+      const auto near = entry_corner[axis] ? box.max[axis] : box.min[axis];
+      const auto far = entry_corner[axis] ? box.min[axis] : box.max[axis];
+      // interval products: the extremes are at the corners.
+      const auto near_a = near - origin_max[axis],
+                 near_b = near - origin_min[axis];
+      const auto far_a = far - origin_max[axis], far_b = far - origin_min[axis];
+      enter = std::max(enter, std::min(std::min(near_a * inv_min[axis],
+                                                near_a * inv_max[axis]),
+                                       std::min(near_b * inv_min[axis],
+                                                near_b * inv_max[axis])));
+      exit = std::min(exit, std::max(std::max(far_a * inv_min[axis],
+                                              far_a * inv_max[axis]),
+                                     std::max(far_b * inv_min[axis],
+                                              far_b * inv_max[axis])));
+    }
+    return enter <= exit ? enter : INF;
+  }
+};
+
+template <typename T> struct BVHNode {
+  AABB<T> bounds;
+  // leaves: index of the first primitive in `BVH::indices`.
+  // interior nodes: index of the right child. The left child is always the
+  // next node.
+  u32 offset = 0;
+  u32 count = 0; // primitives in the leaf, 0 for interior nodes.
+
+  bool is_leaf() const noexcept { return count != 0; }
+};
+
+// Bounding volume hierarchy over a set of primitive bounds, built with a binned
+// surface area heuristic. The hierarchy doesn't know about the primitives
+// themselves: leaves refer to ranges of `indices`, which is the order the
+// caller should lay its primitives out in.
+template <typename T> class BVH {
+  static constexpr T INF = AABB<T>::INF;
+  // nodes traversal can put off for later, which bounds the depth.
+  static constexpr size_t STACK_SIZE = 64;
+  std::vector<BVHNode<T>> own_nodes; // unused while borrowing
+
+public:
+  // the hierarchy's own nodes, or the ones given to `borrow`. Children are
+  // referred to by index, so the nodes can be stored and used anywhere.
+  std::span<const BVHNode<T>> nodes;
+  // only filled by `build`.
+  std::vector<u32> indices;
+
+  BVH() = default;
+  // `nodes` would still point into the original's.
+  BVH(const BVH &) = delete;
+  BVH &operator=(const BVH &) = delete;
+  BVH(BVH &&) noexcept = default;
+  BVH &operator=(BVH &&) noexcept = default;
+
+  // builds the hierarchy, splitting the upper levels across `thread_count`
+  // threads.
+  void build(std::span<const AABB<T>> bounds, size_t thread_count);
+  // uses nodes owned by someone else, such as a mapped scene cache, instead
+  // of building them. They must outlive the hierarchy.
+  void borrow(std::span<const BVHNode<T>> borrowed) noexcept {
+    own_nodes = {};
+    indices = {};
+    nodes = borrowed;
+  }
+  bool empty() const noexcept { return nodes.empty(); }
+  // whether the nodes form a tree that traversal can walk without leaving
+  // them or overflowing its stack, with leaves within `primitive_count`
+  // primitives. Borrowed nodes may come from a damaged file.
+  bool valid(size_t primitive_count) const {
+    if (nodes.empty())
+      return true;
+    // nodes to check, with the number of interior nodes above them. Children
+    // come after their parent, so the walk ends; a tree visits every node at
+    // most once, so it also ends quickly.
+    std::vector<std::pair<u32, size_t>> pending{{0, 0}};
+    size_t visited = 0;
+    while (!pending.empty()) {
+      const auto [index, depth] = pending.back();
+      pending.pop_back();
+      if (++visited > nodes.size())
+        return false;
+      const auto &node = nodes[index];
+      if (node.is_leaf()) {
+        if (u64(node.offset) + node.count > primitive_count)
+          return false;
+        continue;
+      }
+      if (depth >= STACK_SIZE || node.offset <= index + 1 ||
+          node.offset >= nodes.size())
+        return false;
+      pending.emplace_back(index + 1, depth + 1);
+      pending.emplace_back(node.offset, depth + 1);
+    }
+    return true;
+  }
+
+  // visits the leaves `ray` may hit nearer than `t_max`, front to back.
+  // `visit_leaf(first, count)` tests the primitives and returns the distance
+  // of the closest hit so far, which is used to prune the rest of the tree.
+  template <typename F>
+  void traverse(const Ray<T> &ray, T t_max, F &&visit_leaf) const {
+    if (nodes.empty())
+      return;
+    const auto inv_direction = T(1) / ray.direction;
+    if (nodes[0].bounds.intersect(ray, inv_direction, t_max) ==
+        INF)
+      return;
+
+    u32 stack[STACK_SIZE];
+    size_t stack_size = 0;
+    u32 current = 0;
+    while (true) {
+      const auto &node = nodes[current];
+      if (node.is_leaf()) {
+        t_max = visit_leaf(node.offset, node.count);
+      } else {
+        u32 near = current + 1, far = node.offset;
+        auto t_near = nodes[near].bounds.intersect(ray, inv_direction, t_max);
+        auto t_far = nodes[far].bounds.intersect(ray, inv_direction, t_max);
+        if (t_far < t_near) {
+          std::swap(near, far);
+          std::swap(t_near, t_far);
+        }
+        if (t_near != INF) {
+          if (t_far != INF)
+            stack[stack_size++] = far;
+          current = near;
+          continue;
+        }
+      }
+
+      // pop until we find a node that is still in front of the closest hit.
+      while (true) {
+        if (stack_size == 0)
+          return;
+        current = stack[--stack_size];
+        if (nodes[current].bounds.intersect(ray, inv_direction, t_max) !=
+            INF)
+          break;
+      }
+    }
+  }
+
+  // visits the leaves any ray of `packet` may hit nearer than its entry in
+  // `closest`, front to back for the packet as a whole. `visit_leaf(first,
+  // count, active)` tests the primitives against the rays in the `active`
+  // mask, the ones whose own slab test passes, and lowers their `closest`.
+  // Incoherent packets are traversed a ray at a time.
+  template <typename F>
+  void traverse(const RayPacket<T> &packet, std::span<const T> closest,
+                F &&visit_leaf) const {
+    using Mask = typename RayPacket<T>::Mask;
+    if (nodes.empty())
+      return;
+    if (!packet.coherent()) {
+      for (size_t i = 0; i != packet.size(); ++i) {
+        traverse(packet.rays[i], closest[i], [&](u32 first, u32 count) {
+          visit_leaf(first, count, Mask(1) << i);
+          return closest[i];
+        });
+      }
+      return;
+    }
+    // the packet only prunes what's behind all of its rays' hits.
+    const auto farthest = [&] {
+      T t = T(0);
+      for (size_t i = 0; i != packet.size(); ++i)
+        t = std::max(t, closest[i]);
+      return t;
+    };
+    auto t_max = farthest();
+    if (packet.enter(nodes[0].bounds, t_max) == INF)
+      return;
+
+    u32 stack[STACK_SIZE];
+    size_t stack_size = 0;
+    u32 current = 0;
+    while (true) {
+      const auto &node = nodes[current];
+      if (node.is_leaf()) {
+        Mask active = 0;
+        for (size_t i = 0; i != packet.size(); ++i) {
+          if (node.bounds.intersect(packet.rays[i], packet.inv_directions[i],
+                                    closest[i]) != INF)
+            active |= Mask(1) << i;
+        }
+        if (active) {
+          visit_leaf(node.offset, node.count, active);
+          t_max = farthest();
+        }
+      } else {
+        u32 near = current + 1, far = node.offset;
+        auto t_near = packet.enter(nodes[near].bounds, t_max);
+        auto t_far = packet.enter(nodes[far].bounds, t_max);
+        if (t_far < t_near) {
+          std::swap(near, far);
+          std::swap(t_near, t_far);
+        }
+        if (t_near != INF) {
+          if (t_far != INF)
+            stack[stack_size++] = far;
+          current = near;
+          continue;
+        }
+      }
+
+      while (true) {
+        if (stack_size == 0)
+          return;
+        current = stack[--stack_size];
+        if (packet.enter(nodes[current].bounds, t_max) != INF)
+          break;
+      }
+    }
+  }
+};
+
+} // namespace renderer::ray_tracer
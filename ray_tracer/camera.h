@@ -0,0 +1,28 @@
+#pragma once
+#include "ray_tracer/ray.h"
+#include <glm/glm.hpp>
+
+namespace renderer::ray_tracer {
+
+// pinhole camera. The defaults look down -z from the origin with a 90 degree
+// horizontal field of view.
+struct Camera {
+  vec3 origin = vec3(0.0);
+  vec3 look_at = vec3(0.0, 0.0, -1.0);
+  vec3 up = vec3(0.0, 1.0, 0.0);
+  // width of the image plane at distance 1: 2 * tan(horizontal fov / 2). The
+  // height follows from the aspect ratio of the image.
+  double viewport_width = 2.0;
+
+  // orthonormal basis the image plane is laid out in.
+  struct Basis {
+    vec3 right, up, forward;
+  };
+  Basis basis() const noexcept {
+    const auto forward = glm::normalize(look_at - origin);
+    const auto right = glm::normalize(glm::cross(forward, up));
+    return Basis{right, glm::cross(right, forward), forward};
+  }
+};
+
+} // namespace renderer::ray_tracer
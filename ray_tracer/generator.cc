@@ -0,0 +1,293 @@
+#include "ray_tracer/generator.h"
+#include "random.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace renderer::ray_tracer {
+
+namespace {
+
+using utils::random::Rng;
+
+// spheres generated from one generator, and so by one thread at a time.
+constexpr size_t BLOCK_SPHERES = size_t(1) << 16;
+// the small spheres pick from these rather than getting a material each, so
+// the material tables stay small however many spheres there are.
+constexpr size_t LAMBERTIAN_PALETTE = 64;
+constexpr size_t METAL_PALETTE = 32;
+
+// generator streams, so no two uses of the seed draw the same numbers.
+constexpr u64 PALETTE_STREAM = 0;
+constexpr u64 SPHERE_STREAM = 1;
+constexpr u64 CLUSTER_STREAM = 2;
+
+// the book's scene: a 22x22 grid of small spheres and these.
+constexpr double WEEKEND_GRID = 22.0;
+constexpr size_t WEEKEND_LARGE_SPHERES = 3;
+const vec3 WEEKEND_LARGE_CENTERS[WEEKEND_LARGE_SPHERES] = {
+    vec3(0.0, 1.0, 0.0), vec3(-4.0, 1.0, 0.0), vec3(4.0, 1.0, 0.0)};
+
+struct GeneratedSphere {
+  Sphere<double> sphere;
+  u32 material;
+};
+
+class Layout {
+  GeneratorSettings settings;
+  // spheres generated in blocks, the fixed ones of the layout aside.
+  size_t count = 0;
+  // weekend: spheres per side of the grid. Others: side of the cube.
+  double extent = 0.0;
+  // weekend: radius of the ground sphere. Clustered: radius of a cluster.
+  double radius = 0.0;
+  size_t cluster_count = 1;
+  std::vector<vec3> cluster_centers;
+  std::vector<u32> lambertian, metal;
+  u32 glass = 0;
+
+  u32 pick_material(Rng &rng) const noexcept {
+    const auto choice = rng.next_double();
+    if (choice < 0.8)
+      return lambertian[rng.next_u32() % lambertian.size()];
+    if (choice < 0.95)
+      return metal[rng.next_u32() % metal.size()];
+    return glass;
+  }
+
+public:
+  explicit Layout(const GeneratorSettings &settings) : settings(settings) {}
+
+  size_t generated_count() const noexcept { return count; }
+  u64 seed() const noexcept { return settings.seed; }
+
+  // sends the camera, the materials and the fixed spheres to `builder`.
+  void begin(SceneBuilder &builder) {
+    const auto palette_material = [&](Rng &rng, MaterialKind kind) {
+      MaterialDesc material{kind};
+      if (kind == MaterialKind::Lambertian) {
+        const auto r = rng.next_double(), g = rng.next_double(),
+                   b = rng.next_double();
+        const auto r2 = rng.next_double(), g2 = rng.next_double(),
+                   b2 = rng.next_double();
+        material.albedo = vec3(r * r2, g * g2, b * b2);
+      } else {
+        const auto r = rng.next_double(), g = rng.next_double(),
+                   b = rng.next_double();
+        material.albedo = vec3(0.5 + 0.5 * r, 0.5 + 0.5 * g, 0.5 + 0.5 * b);
+        material.fuzz = 0.5 * rng.next_double();
+      }
+      return builder.add_material(material);
+    };
+    Rng rng(settings.seed, PALETTE_STREAM);
+    for (size_t i = 0; i != LAMBERTIAN_PALETTE; ++i)
+      lambertian.push_back(palette_material(rng, MaterialKind::Lambertian));
+    for (size_t i = 0; i != METAL_PALETTE; ++i)
+      metal.push_back(palette_material(rng, MaterialKind::Metal));
+    glass = builder.add_material(MaterialDesc{MaterialKind::Dielectric});
+
+    Camera camera;
+    switch (settings.layout) {
+    case SceneLayout::Weekend: {
+      const auto fixed = WEEKEND_LARGE_SPHERES + 1;
+      count = settings.sphere_count > fixed ? settings.sphere_count - fixed : 0;
+      extent = std::max(1.0, std::ceil(std::sqrt(double(count))));
+      // the camera and the ground move out with the grid, so it's framed and
+      // curves away the same at any size.
+      const auto scale = std::max(1.0, extent / WEEKEND_GRID);
+      radius = 1000.0 * scale;
+      camera.origin = vec3(13.0, 2.0, 3.0) * scale;
+      camera.look_at = vec3(0.0);
+      // the book's 20 degree vertical field of view at 3:2.
+      camera.viewport_width = 2.0 * std::tan(glm::radians(20.0) * 0.5) * 1.5;
+
+      const auto ground =
+          builder.add_material(MaterialDesc{MaterialKind::Lambertian});
+      const auto brown = builder.add_material(
+          MaterialDesc{MaterialKind::Lambertian, vec3(0.4, 0.2, 0.1)});
+      const auto mirror = builder.add_material(
+          MaterialDesc{MaterialKind::Metal, vec3(0.7, 0.6, 0.5), 0.0});
+      builder.reserve(count + fixed);
+      builder.add_sphere(Sphere<double>{vec3(0.0, -radius, 0.0), radius},
+                         ground);
+      const u32 large_materials[WEEKEND_LARGE_SPHERES] = {glass, brown, mirror};
+      for (size_t i = 0; i != WEEKEND_LARGE_SPHERES; ++i) {
+        builder.add_sphere(Sphere<double>{WEEKEND_LARGE_CENTERS[i], 1.0},
+                           large_materials[i]);
+      }
+      break;
+    }
+    case SceneLayout::Clustered:
+      // a few thousand spheres per cluster on average, but the first clusters
+      // get far more than the last (see `generate`).
+      cluster_count = std::max<size_t>(1, settings.sphere_count / 4096);
+      [[fallthrough]];
+    case SceneLayout::Uniform:
+      count = settings.sphere_count;
+      // about one sphere per 8 cubic units either way.
+      extent = 2.0 * std::cbrt(double(std::max<size_t>(count, 1)));
+      radius = 0.5 * extent / std::cbrt(double(cluster_count));
+      if (settings.layout == SceneLayout::Clustered) {
+        Rng rng(settings.seed, CLUSTER_STREAM);
+        for (size_t i = 0; i != cluster_count; ++i) {
+          const auto x = rng.next_double(), y = rng.next_double();
+          cluster_centers.push_back((vec3(x, y, rng.next_double()) - 0.5) *
+                                    (extent - 2.0 * radius));
+        }
+      }
+      camera.origin = vec3(0.9, 0.6, 1.4) * extent;
+      camera.look_at = vec3(0.0);
+      camera.viewport_width = 2.0 * std::tan(glm::radians(60.0) * 0.5);
+      builder.reserve(count);
+      break;
+    }
+    builder.set_camera(camera);
+  }
+
+  GeneratedSphere generate(size_t index, Rng &rng) const noexcept {
+    switch (settings.layout) {
+    case SceneLayout::Weekend: {
+      const auto side = static_cast<size_t>(extent);
+      const auto half = 0.5 * extent;
+      auto x = double(index % side) - half + 0.9 * rng.next_double();
+      auto z = double(index / side) - half + 0.9 * rng.next_double();
+      // the book skips spheres that would touch a large one. Pushing them
+      // clear keeps the count.
+      for (const auto &center : WEEKEND_LARGE_CENTERS) {
+        const auto dx = x - center.x, dz = z - center.z;
+        const auto distance = std::sqrt(dx * dx + dz * dz);
+        if (distance == 0.0) {
+          x = center.x + 1.2;
+        } else if (distance < 1.2) {
+          x = center.x + dx * (1.2 / distance);
+          z = center.z + dz * (1.2 / distance);
+        }
+      }
+      // resting on the ground, which curves away from the origin.
+      const auto y = std::sqrt(radius * radius - x * x - z * z) - radius + 0.2;
+      return {Sphere<double>{vec3(x, y, z), 0.2}, pick_material(rng)};
+    }
+    case SceneLayout::Uniform: {
+      const auto x = rng.next_double(), y = rng.next_double(),
+                 z = rng.next_double();
+      const auto center = (vec3(x, y, z) - 0.5) * extent;
+      const auto sphere_radius = 0.2 + 0.3 * rng.next_double();
+      return {Sphere<double>{center, sphere_radius}, pick_material(rng)};
+    }
+    case SceneLayout::Clustered: {
+      // squaring skews the pick towards the first clusters.
+      const auto u = rng.next_double();
+      const auto cluster = std::min(
+          static_cast<size_t>(u * u * double(cluster_count)),
+          cluster_count - 1);
+      vec3 offset;
+      do {
+        const auto x = rng.next_double(), y = rng.next_double();
+        offset = vec3(x, y, rng.next_double()) * 2.0 - 1.0;
+      } while (glm::dot(offset, offset) > 1.0);
+      // denser towards the middle of the cluster.
+      offset *= radius * rng.next_double();
+      const auto sphere_radius = 0.05 + 0.15 * rng.next_double();
+      return {Sphere<double>{cluster_centers[cluster] + offset, sphere_radius},
+              pick_material(rng)};
+    }
+    }
+    return {};
+  }
+};
+
+void generate_block(const Layout &layout, size_t block,
+                    std::vector<GeneratedSphere> &out) {
+  const auto first = block * BLOCK_SPHERES;
+  out.resize(std::min(BLOCK_SPHERES, layout.generated_count() - first));
+  Rng rng(utils::random::hash(layout.seed(), block), SPHERE_STREAM);
+  for (size_t i = 0; i != out.size(); ++i)
+    out[i] = layout.generate(first + i, rng);
+}
+
+} // namespace
+
+std::optional<SceneLayout> parse_scene_layout(std::string_view name) noexcept {
+  for (const auto layout :
+       {SceneLayout::Weekend, SceneLayout::Uniform, SceneLayout::Clustered}) {
+    if (to_string(layout) == name)
+      return layout;
+  }
+  return std::nullopt;
+}
+
+std::string_view to_string(SceneLayout layout) noexcept {
+  switch (layout) {
+  case SceneLayout::Weekend:
+    return "weekend";
+  case SceneLayout::Uniform:
+    return "uniform";
+  case SceneLayout::Clustered:
+    return "clustered";
+  }
+  return "unknown";
+}
+
+std::optional<GeneratorSettings>
+parse_generator_settings(std::string_view text) noexcept {
+  GeneratorSettings settings;
+  const auto layout_end = text.find(':');
+  const auto layout = parse_scene_layout(text.substr(0, layout_end));
+  if (!layout)
+    return std::nullopt;
+  settings.layout = *layout;
+  if (layout_end == std::string_view::npos)
+    return settings;
+  text.remove_prefix(layout_end + 1);
+
+  const auto parse = [](std::string_view field, auto &out) {
+    const auto [ptr, err] =
+        std::from_chars(field.data(), field.data() + field.size(), out);
+    return err == std::errc() && ptr == field.data() + field.size();
+  };
+  const auto count_end = text.find(':');
+  if (!parse(text.substr(0, count_end), settings.sphere_count) ||
+      settings.sphere_count == 0 ||
+      settings.sphere_count >= SphereSet<double>::NO_SPHERE)
+    return std::nullopt;
+  if (count_end != std::string_view::npos &&
+      !parse(text.substr(count_end + 1), settings.seed))
+    return std::nullopt;
+  return settings;
+}
+
+void generate_scene(const GeneratorSettings &settings, SceneBuilder &builder,
+                    size_t thread_count) {
+  Layout layout(settings);
+  layout.begin(builder);
+
+  const auto block_count =
+      (layout.generated_count() + BLOCK_SPHERES - 1) / BLOCK_SPHERES;
+  if (block_count == 0)
+    return;
+  thread_count = std::clamp<size_t>(thread_count, 1, block_count);
+  // blocks are handed to the builder in order, a few per thread at a time, so
+  // only those are ever held.
+  std::vector<std::vector<GeneratedSphere>> batch(2 * thread_count);
+  for (size_t first = 0; first < block_count; first += batch.size()) {
+    const auto blocks = std::min(batch.size(), block_count - first);
+    const auto work = [&](size_t worker) {
+      for (size_t i = worker; i < blocks; i += thread_count)
+        generate_block(layout, first + i, batch[i]);
+    };
+    std::vector<std::thread> workers;
+    for (size_t worker = 1; worker < thread_count; ++worker)
+      workers.emplace_back(work, worker);
+    work(0);
+    for (auto &worker : workers)
+      worker.join();
+    for (size_t i = 0; i != blocks; ++i) {
+      for (const auto &generated : batch[i])
+        builder.add_sphere(generated.sphere, generated.material);
+    }
+  }
+}
+
+} // namespace renderer::ray_tracer
@@ -0,0 +1,42 @@
+#pragma once
+#include "ray_tracer/scene.h"
+#include "types.h"
+#include <optional>
+#include <string_view>
+
+namespace renderer::ray_tracer {
+
+// Procedural scenes of any size, for timing loading, BVH builds and traversal
+// as scenes grow:
+//   weekend    the final scene of Ray Tracing in One Weekend: three large
+//              spheres among small ones on a ground sphere, the grid of small
+//              spheres widened to fit the count.
+//   uniform    spheres spread evenly through a cube.
+//   clustered  spheres packed into clusters of very different densities,
+//              which is harder on the BVH.
+// Every layout keeps its density as the count grows, so only the size of the
+// scene changes.
+enum class SceneLayout { Weekend, Uniform, Clustered };
+
+std::optional<SceneLayout> parse_scene_layout(std::string_view name) noexcept;
+std::string_view to_string(SceneLayout layout) noexcept;
+
+struct GeneratorSettings {
+  SceneLayout layout = SceneLayout::Weekend;
+  // spheres in the scene, the fixed ones of the layout included.
+  size_t sphere_count = 500;
+  u64 seed = 1;
+};
+
+// parses `layout[:count[:seed]]`, e.g. `weekend:10000000`.
+std::optional<GeneratorSettings>
+parse_generator_settings(std::string_view text) noexcept;
+
+// Generates the scene into `builder`: the camera, the materials and then the
+// spheres, in order. Spheres are generated in fixed blocks, each from a
+// generator keyed by the seed and the block, over `thread_count` threads. The
+// scene only depends on `settings`, never on the thread count.
+void generate_scene(const GeneratorSettings &settings, SceneBuilder &builder,
+                    size_t thread_count);
+
+} // namespace renderer::ray_tracer
@@ -0,0 +1,200 @@
+#pragma once
+#include "ray_tracer/ray.h"
+#include "ray_tracer/sampler.h"
+#include "types.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace renderer::ray_tracer {
+
+// attenuation and scattered direction. A black attenuation ends the path.
+template <typename T> using Scatter = std::pair<vec3_t<T>, vec3_t<T>>;
+
+// maps a point of the unit square to a uniformly distributed direction.
+template <typename T>
+vec3_t<T> unit_vector_from(std::pair<double, double> u) noexcept {
+  constexpr double TAU = 6.283185307179586;
+  const auto z = 1.0 - 2.0 * u.first;
+  const auto r = std::sqrt(std::max(0.0, 1.0 - z * z));
+  const auto phi = TAU * u.second;
+  return vec3_t<T>(r * std::cos(phi), r * std::sin(phi), z);
+}
+template <typename T>
+vec3_t<T> random_in_hemisphere(vec3_t<T> normal, Sampler &sampler) noexcept {
+  const auto p = unit_vector_from<T>(sampler.next_2d());
+  return glm::dot(normal, p) < T(0) ? -p : p;
+}
+template <typename T>
+vec3_t<T> refract(const vec3_t<T> v, const vec3_t<T> n, T refraction_ratio) {
+  const auto nndotv = n * glm::dot(-v, n);
+  const auto s = nndotv + v;
+  const auto v_perp = s / refraction_ratio;
+  const auto v_parallel = -nndotv;
+  return v_perp + v_parallel;
+}
+
+// Material kinds are plain values with a non-virtual `scatter`. To add one,
+// define it here and append it to `Materials` below.
+template <typename T> struct Lambertian {
+  using vec3 = vec3_t<T>;
+  vec3 albedo;
+
+  Scatter<T> scatter(vec3, const Hit<T> &hit,
+                     Sampler &sampler) const noexcept {
+    // normal plus a uniform unit vector is cosine distributed around the
+    // normal.
+    const auto direction =
+        hit.normal + unit_vector_from<T>(sampler.next_2d());
+    // the two can cancel out, leaving no direction to normalize.
+    if (glm::dot(direction, direction) < T(1e-12))
+      return {albedo, hit.normal};
+    return {albedo, glm::normalize(direction)};
+  }
+};
+
+template <typename T> struct Metal {
+  using vec3 = vec3_t<T>;
+  vec3 albedo;
+  T fuzz;
+
+  constexpr Metal(vec3 albedo, T fuzz)
+      : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
+
+  Scatter<T> scatter(vec3 ray_direction, const Hit<T> &hit,
+                     Sampler &sampler) const noexcept {
+    const auto reflected = glm::reflect(ray_direction, hit.normal) +
+                           fuzz * random_in_hemisphere(hit.normal, sampler);
+    // only reflect if the resulting reflected ray is above the normal.
+    const auto attenuation =
+        glm::dot(reflected, hit.normal) > T(0) ? albedo : vec3(0);
+    return {attenuation, reflected};
+  }
+};
+
+template <typename T> struct Dielectric {
+  using vec3 = vec3_t<T>;
+  T refraction_index;
+
+  Scatter<T> scatter(vec3 ray_direction, const Hit<T> &hit,
+                     Sampler &sampler) const noexcept {
+    const auto refraction_ratio =
+        hit.front_face ? T(1) / refraction_index : refraction_index;
+    const auto cos_theta =
+        glm::min(glm::dot(-ray_direction, hit.normal), T(1));
+    const auto sin_theta = glm::sqrt(glm::abs(T(1) - cos_theta * cos_theta));
+    const auto cannot_refract = sin_theta * refraction_ratio > T(1);
+    if (cannot_refract ||
+        reflectance(cos_theta, refraction_index) > sampler.next_1d())
+      return {vec3(1), glm::reflect(ray_direction, hit.normal)};
+    return {vec3(1), refract(ray_direction, hit.normal, refraction_ratio)};
+  }
+
+private:
+  static T reflectance(T cosine, T refraction_index) {
+    // Use Schlick's approximation for reflectance.
+    auto r0 = (T(1) - refraction_index) / (T(1) + refraction_index);
+    r0 = r0 * r0;
+    return r0 + (T(1) - r0) * glm::pow(T(1) - cosine, T(5));
+  }
+};
+
+// A material is referred to by its kind, in the top bits, and its index among
+// the materials of that kind.
+struct MaterialId {
+  static constexpr u32 INDEX_BITS = 24;
+  static constexpr u32 INDEX_MASK = (u32(1) << INDEX_BITS) - 1;
+  // materials of one kind ids can tell apart.
+  static constexpr size_t MAX_PER_KIND = size_t(1) << INDEX_BITS;
+
+  u32 value = 0;
+
+  static constexpr MaterialId make(u32 kind, u32 index) noexcept {
+    return MaterialId{kind << INDEX_BITS | index};
+  }
+  constexpr u32 kind() const noexcept { return value >> INDEX_BITS; }
+  constexpr u32 index() const noexcept { return value & INDEX_MASK; }
+};
+
+// Materials stored contiguously per kind. The kinds are a closed list known at
+// compile time, so `scatter` dispatches with a switch over the kind instead of
+// a virtual call, and every kind's `scatter` can be inlined into the caller.
+template <typename... Kinds> class MaterialTable {
+  static_assert(sizeof...(Kinds) <= (1 << (32 - MaterialId::INDEX_BITS)),
+                "too many material kinds for MaterialId");
+
+  std::tuple<std::vector<Kinds>...> kinds;
+
+  template <size_t... I>
+  bool contains(MaterialId id, std::index_sequence<I...>) const noexcept {
+    return ((id.kind() == I && id.index() < std::get<I>(kinds).size()) ||
+            ...);
+  }
+
+  template <typename T, size_t... I>
+  Scatter<T> scatter(MaterialId id, vec3_t<T> ray_direction, const Hit<T> &hit,
+                     Sampler &sampler,
+                     std::index_sequence<I...>) const noexcept {
+    Scatter<T> result{vec3_t<T>(0), vec3_t<T>(0)};
+    // the fold expands to a chain of comparisons against constants, which
+    // the compiler turns into a switch.
+    ((id.kind() == I
+          ? (result = std::get<I>(kinds)[id.index()].scatter(ray_direction,
+                                                             hit, sampler),
+             true)
+          : false) ||
+     ...);
+    return result;
+  }
+
+public:
+  static constexpr size_t KIND_COUNT = sizeof...(Kinds);
+
+  // the position of `Kind` in the list, which `MaterialId::kind` holds.
+  template <typename Kind, size_t I = 0> static constexpr u32 kind_of() {
+    static_assert(I < sizeof...(Kinds), "material kind is not registered");
+    if constexpr (std::is_same_v<Kind,
+                                 std::tuple_element_t<I, std::tuple<Kinds...>>>)
+      return I;
+    else
+      return kind_of<Kind, I + 1>();
+  }
+
+  template <size_t I> const auto &of_kind() const noexcept {
+    return std::get<I>(kinds);
+  }
+
+  // whether `id` refers to a material of the table.
+  bool contains(MaterialId id) const noexcept {
+    return contains(id, std::index_sequence_for<Kinds...>{});
+  }
+
+  // throws `std::length_error` once `Kind` has `MaterialId::MAX_PER_KIND`
+  // materials, rather than letting the index spill into the kind. Loaders
+  // check first and report it.
+  template <typename Kind> MaterialId add(Kind material) {
+    auto &storage = std::get<std::vector<Kind>>(kinds);
+    if (storage.size() == MaterialId::MAX_PER_KIND)
+      throw std::length_error("too many materials of one kind");
+    storage.push_back(std::move(material));
+    return MaterialId::make(kind_of<Kind>(), u32(storage.size() - 1));
+  }
+
+  template <typename T>
+  Scatter<T> scatter(MaterialId id, vec3_t<T> ray_direction, const Hit<T> &hit,
+                     Sampler &sampler) const noexcept {
+    return scatter(id, ray_direction, hit, sampler,
+                   std::index_sequence_for<Kinds...>{});
+  }
+};
+
+// every material kind the renderer knows about.
+template <typename T>
+using Materials = MaterialTable<Lambertian<T>, Metal<T>, Dielectric<T>>;
+
+} // namespace renderer::ray_tracer
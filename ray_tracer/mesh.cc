@@ -0,0 +1,221 @@
+#include "ray_tracer/mesh.h"
+#include <bit>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+namespace renderer::ray_tracer {
+namespace {
+
+// A ray set up for the watertight ray/triangle test of Woop, Benthin and Wald
+// ("Watertight Ray/Triangle Intersection", JCGT 2013). The triangle is moved
+// into a space where the ray starts at the origin and runs along +z, so the
+// test reduces to 2D edge functions. Edges shared by two triangles evaluate
+// to exactly the same value for both, so rays can't slip between them.
+template <typename T> struct ShearedRay {
+  vec3_t<T> origin;
+  int kx, ky, kz;
+  T sx, sy, sz;
+
+  ShearedRay() = default;
+  explicit ShearedRay(const Ray<T> &ray) noexcept : origin(ray.origin) {
+    const auto magnitude = glm::abs(ray.direction);
+    kz = magnitude.x > magnitude.y ? (magnitude.x > magnitude.z ? 0 : 2)
+                                   : (magnitude.y > magnitude.z ? 1 : 2);
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    // keeps the winding of the triangle.
+    if (ray.direction[kz] < T(0))
+      std::swap(kx, ky);
+    sx = ray.direction[kx] / ray.direction[kz];
+    sy = ray.direction[ky] / ray.direction[kz];
+    sz = T(1) / ray.direction[kz];
+  }
+
+  // distance to the triangle nearer than `closest`, along with the
+  // barycentrics of its second and third corners.
+  bool intersect(const vec3_t<T> &p0, const vec3_t<T> &p1,
+                 const vec3_t<T> &p2, T &closest, T &b1,
+                 T &b2) const noexcept {
+    const auto a = p0 - origin, b = p1 - origin, c = p2 - origin;
+    const auto ax = a[kx] - sx * a[kz], ay = a[ky] - sy * a[kz];
+    const auto bx = b[kx] - sx * b[kz], by = b[ky] - sy * b[kz];
+    const auto cx = c[kx] - sx * c[kz], cy = c[ky] - sy * c[kz];
+    auto u = cx * by - cy * bx;
+    auto v = ax * cy - ay * cx;
+    auto w = bx * ay - by * ax;
+    if constexpr (std::is_same_v<T, float>) {
+      // a zero edge function may just be float rounding. Double tells which
+      // side of the edge the ray really is.
+      if (u == 0.0f || v == 0.0f || w == 0.0f) {
+        u = float(double(cx) * by - double(cy) * bx);
+        v = float(double(ax) * cy - double(ay) * cx);
+        w = float(double(bx) * ay - double(by) * ax);
+      }
+    }
+    if ((u < T(0) || v < T(0) || w < T(0)) &&
+        (u > T(0) || v > T(0) || w > T(0)))
+      return false;
+    const auto det = u + v + w;
+    if (det == T(0))
+      return false;
+    const auto t = (u * sz * a[kz] + v * sz * b[kz] + w * sz * c[kz]) / det;
+    if (!(t > MIN_HIT_DISTANCE<T> && t < closest))
+      return false;
+    closest = t;
+    b1 = v / det;
+    b2 = w / det;
+    return true;
+  }
+};
+
+} // namespace
+
+template <typename T> void TriangleMesh<T>::view_own_arrays() noexcept {
+  positions = own_positions;
+  normals = own_normals;
+  indices = own_indices;
+  normal_indices = own_normal_indices;
+}
+
+template <typename T>
+void TriangleMesh<T>::assign(std::vector<vec3_t<T>> new_positions,
+                             std::vector<vec3_t<T>> new_normals,
+                             std::vector<u32> new_indices,
+                             std::vector<u32> new_normal_indices) {
+  own_positions = std::move(new_positions);
+  own_normals = std::move(new_normals);
+  own_indices = std::move(new_indices);
+  own_normal_indices = std::move(new_normal_indices);
+  bvh = {};
+  view_own_arrays();
+}
+
+template <typename T>
+void TriangleMesh<T>::borrow(std::span<const vec3_t<T>> new_positions,
+                             std::span<const vec3_t<T>> new_normals,
+                             std::span<const u32> new_indices,
+                             std::span<const u32> new_normal_indices) noexcept {
+  own_positions = {};
+  own_normals = {};
+  own_indices = {};
+  own_normal_indices = {};
+  positions = new_positions;
+  normals = new_normals;
+  indices = new_indices;
+  normal_indices = new_normal_indices;
+}
+
+template <typename T>
+void TriangleMesh<T>::build_acceleration(size_t thread_count) {
+  const auto count = triangle_count();
+  std::vector<AABB<T>> bounds(count);
+  for (size_t i = 0; i != count; ++i) {
+    for (size_t corner = 0; corner != 3; ++corner)
+      bounds[i].grow(positions[indices[3 * i + corner]]);
+  }
+  bvh.build(bounds, thread_count);
+
+  // lay the triangles out in leaf order so leaves index them directly. The
+  // vertices stay where they are.
+  const auto permute = [&](std::vector<u32> &corners) {
+    std::vector<u32> reordered(corners.size());
+    for (size_t i = 0; i != count; ++i) {
+      for (size_t corner = 0; corner != 3; ++corner)
+        reordered[3 * i + corner] = corners[3 * bvh.indices[i] + corner];
+    }
+    corners = std::move(reordered);
+  };
+  permute(own_indices);
+  if (!own_normal_indices.empty())
+    permute(own_normal_indices);
+  view_own_arrays();
+}
+
+template <typename T>
+bool TriangleMesh<T>::intersect(const Ray<T> &ray, T &closest,
+                                TriangleHit<T> &where) const noexcept {
+  const ShearedRay<T> sheared(ray);
+  bool found = false;
+  bvh.traverse(ray, closest, [&](u32 first, u32 count) {
+    for (auto i = first; i != first + count; ++i) {
+      const auto corners = &indices[3 * size_t(i)];
+      if (sheared.intersect(positions[corners[0]], positions[corners[1]],
+                            positions[corners[2]], closest, where.b1,
+                            where.b2)) {
+        where.triangle = i;
+        found = true;
+      }
+    }
+    return closest;
+  });
+  return found;
+}
+
+template <typename T>
+typename RayPacket<T>::Mask
+TriangleMesh<T>::intersect(const RayPacket<T> &packet, std::span<T> closest,
+                           std::span<TriangleHit<T>> where) const noexcept {
+  using Mask = typename RayPacket<T>::Mask;
+  // set up when a ray first reaches a leaf: many never do.
+  ShearedRay<T> sheared[RayPacket<T>::MAX_SIZE];
+  Mask ready = 0, found = 0;
+  bvh.traverse(packet, closest, [&](u32 first, u32 count, Mask active) {
+    for (; active; active &= active - 1) {
+      const auto ray = static_cast<size_t>(std::countr_zero(active));
+      if (!(ready & (Mask(1) << ray))) {
+        sheared[ray] = ShearedRay<T>(packet.rays[ray]);
+        ready |= Mask(1) << ray;
+      }
+      for (auto i = first; i != first + count; ++i) {
+        const auto corners = &indices[3 * size_t(i)];
+        if (sheared[ray].intersect(positions[corners[0]],
+                                   positions[corners[1]],
+                                   positions[corners[2]], closest[ray],
+                                   where[ray].b1, where[ray].b2)) {
+          where[ray].triangle = i;
+          found |= Mask(1) << ray;
+        }
+      }
+    }
+  });
+  return found;
+}
+
+template <typename T>
+Hit<T> TriangleMesh<T>::hit(const Ray<T> &ray, T t,
+                            const TriangleHit<T> &where) const noexcept {
+  const auto first = 3 * size_t(where.triangle);
+  const auto &p0 = positions[indices[first]];
+  const auto &p1 = positions[indices[first + 1]];
+  const auto &p2 = positions[indices[first + 2]];
+  const auto b0 = T(1) - where.b1 - where.b2;
+  // on the plane of the triangle, unlike `ray.at(t)`.
+  const auto point = b0 * p0 + where.b1 * p1 + where.b2 * p2;
+  // the winding tells the front from the back.
+  const auto geometric = glm::cross(p1 - p0, p2 - p0);
+  auto normal = glm::normalize(geometric);
+  if (!normal_indices.empty()) {
+    const auto n0 = normal_indices[first], n1 = normal_indices[first + 1],
+               n2 = normal_indices[first + 2];
+    if (n0 != NO_NORMAL && n1 != NO_NORMAL && n2 != NO_NORMAL) {
+      const auto shading =
+          b0 * normals[n0] + where.b1 * normals[n1] + where.b2 * normals[n2];
+      // opposite normals can cancel out.
+      if (glm::dot(shading, shading) > T(1e-12)) {
+        normal = glm::normalize(shading);
+        if (glm::dot(normal, geometric) < T(0))
+          normal = -normal;
+      }
+    }
+  }
+  // meshes are two sided: the normal always faces the ray.
+  const bool front_face = glm::dot(ray.direction, geometric) < T(0);
+  return Hit<T>{point, front_face ? normal : -normal, t, material,
+                front_face};
+}
+
+template class TriangleMesh<float>;
+template class TriangleMesh<double>;
+
+} // namespace renderer::ray_tracer
@@ -0,0 +1,79 @@
+#pragma once
+#include "ray_tracer/bvh.h"
+#include "ray_tracer/ray.h"
+#include "types.h"
+#include <span>
+#include <vector>
+
+namespace renderer::ray_tracer {
+
+// which triangle of a mesh a ray hit, and where: the barycentric weights of
+// its second and third corners.
+template <typename T> struct TriangleHit {
+  u32 triangle = 0;
+  T b1 = 0, b2 = 0;
+};
+
+// An indexed triangle mesh with a single material. Triangles refer to shared
+// vertices through `indices`, three per triangle, and may refer to vertex
+// normals through `normal_indices` to be shaded smoothly. The mesh has a BVH
+// of its own, and `build_acceleration` reorders the triangles to match its
+// leaves.
+template <typename T> class TriangleMesh {
+  // filled by `assign`. Unused while the mesh borrows its arrays.
+  std::vector<vec3_t<T>> own_positions, own_normals;
+  std::vector<u32> own_indices, own_normal_indices;
+
+  void view_own_arrays() noexcept;
+
+public:
+  // corners without a normal. Their triangle is shaded flat.
+  static constexpr u32 NO_NORMAL = ~u32(0);
+
+  // what everything reads: the mesh's own arrays, or the ones given to
+  // `borrow`.
+  std::span<const vec3_t<T>> positions, normals;
+  std::span<const u32> indices;
+  // empty, or three per triangle.
+  std::span<const u32> normal_indices;
+  u32 material = 0; // a `MaterialId`
+  BVH<T> bvh;
+
+  TriangleMesh() = default;
+  // the views would still point into the original's arrays.
+  TriangleMesh(const TriangleMesh &) = delete;
+  TriangleMesh &operator=(const TriangleMesh &) = delete;
+  TriangleMesh(TriangleMesh &&) noexcept = default;
+  TriangleMesh &operator=(TriangleMesh &&) noexcept = default;
+
+  size_t triangle_count() const noexcept { return indices.size() / 3; }
+  bool empty() const noexcept { return indices.empty(); }
+  // replaces the geometry. Indices must be in range: only loaders check them.
+  void assign(std::vector<vec3_t<T>> new_positions,
+              std::vector<vec3_t<T>> new_normals, std::vector<u32> new_indices,
+              std::vector<u32> new_normal_indices);
+  // reads the geometry from arrays owned by someone else, such as a mapped
+  // scene cache, instead of copying it. They must outlive the mesh, and
+  // already be in the order of the BVH the mesh is given.
+  void borrow(std::span<const vec3_t<T>> new_positions,
+              std::span<const vec3_t<T>> new_normals,
+              std::span<const u32> new_indices,
+              std::span<const u32> new_normal_indices) noexcept;
+
+  // builds the BVH and lays the triangles out in leaf order.
+  void build_acceleration(size_t thread_count);
+  // finds the nearest triangle hit nearer than `closest`, and lowers
+  // `closest` to it. Only the distance and the barycentrics are computed;
+  // `hit` turns them into a `Hit` for the winner.
+  bool intersect(const Ray<T> &ray, T &closest,
+                 TriangleHit<T> &where) const noexcept;
+  // the same for every ray of `packet`, with one `closest` and `where` per
+  // ray. Returns the rays that found a nearer hit.
+  typename RayPacket<T>::Mask
+  intersect(const RayPacket<T> &packet, std::span<T> closest,
+            std::span<TriangleHit<T>> where) const noexcept;
+  Hit<T> hit(const Ray<T> &ray, T t,
+             const TriangleHit<T> &where) const noexcept;
+};
+
+} // namespace renderer::ray_tracer
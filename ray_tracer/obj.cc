@@ -0,0 +1,322 @@
+#include "ray_tracer/obj.h"
+#include "log.h"
+#include "mapped_file.h"
+#include "timer.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <utility>
+#include <vector>
+
+static utils::Log objlog("obj");
+
+namespace renderer::ray_tracer {
+namespace {
+
+// files are split into chunks of at least this size, so small ones are
+// parsed by one thread.
+constexpr size_t MIN_CHUNK_SIZE = size_t(1) << 20;
+
+// what one chunk of the file holds, with 0 based indices. Negative OBJ
+// indices count back from the last vertex read, which depends on the chunks
+// before this one: they're stored relative to the chunk's first vertex
+// (wrapping around below it) and listed in `relative_*` so they can be
+// offset once the chunks before are counted.
+struct Chunk {
+  std::vector<vec3> positions, normals;
+  std::vector<u32> indices, normal_indices;
+  std::vector<size_t> relative_indices, relative_normal_indices;
+  bool has_normals = false;
+  size_t lines = 0;
+  // the first error, at line `error_line` of the chunk.
+  std::string_view error;
+  size_t error_line = 0;
+};
+
+// the whitespace separated fields of a line.
+class Fields {
+  const char *cursor;
+  const char *end;
+
+public:
+  Fields(const char *begin, const char *end) : cursor(begin), end(end) {}
+
+  bool empty() noexcept {
+    while (cursor != end && (*cursor == ' ' || *cursor == '\t' ||
+                             *cursor == '\r'))
+      ++cursor;
+    return cursor == end || *cursor == '#';
+  }
+
+  std::string_view next() noexcept {
+    if (empty())
+      return {};
+    const auto start = cursor;
+    while (cursor != end && *cursor != ' ' && *cursor != '\t' &&
+           *cursor != '\r')
+      ++cursor;
+    return {start, static_cast<size_t>(cursor - start)};
+  }
+
+  bool vector(vec3 &out) noexcept {
+    for (int axis = 0; axis != 3; ++axis) {
+      const auto field = next();
+      const auto [ptr, err] = std::from_chars(
+          field.data(), field.data() + field.size(), out[axis]);
+      if (field.empty() || err != std::errc() ||
+          ptr != field.data() + field.size() || !std::isfinite(out[axis]))
+        return false;
+    }
+    return true;
+  }
+};
+
+// a face corner: `v`, `v/vt`, `v//vn` or `v/vt/vn`. `normal` is 0 when the
+// corner has none.
+bool parse_corner(std::string_view field, i64 &position, i64 &normal) {
+  const auto end = field.data() + field.size();
+  const auto [ptr, err] = std::from_chars(field.data(), end, position);
+  if (err != std::errc() || position == 0)
+    return false;
+  normal = 0;
+  if (ptr == end)
+    return true;
+  if (*ptr != '/')
+    return false;
+  // the texture coordinate is skipped.
+  const auto slash = std::find(ptr + 1, end, '/');
+  if (slash == end)
+    return true;
+  const auto normal_result = std::from_chars(slash + 1, end, normal);
+  return normal_result.ec == std::errc() && normal_result.ptr == end &&
+         normal != 0;
+}
+
+class ChunkParser {
+  Chunk &chunk;
+  // corners of the face being read: position, normal and whether each is
+  // relative.
+  struct Corner {
+    u32 position, normal;
+    bool relative_position, relative_normal;
+  };
+  std::vector<Corner> corners;
+
+  // turns an OBJ index into a 0 based one: `read` elements of its kind were
+  // read from this chunk before it.
+  static bool resolve(i64 index, size_t read, u32 &out, bool &relative) {
+    if (index > i64(std::numeric_limits<u32>::max()) ||
+        index < -i64(std::numeric_limits<u32>::max()))
+      return false;
+    relative = index < 0;
+    out = relative ? static_cast<u32>(read) + static_cast<u32>(index)
+                   : static_cast<u32>(index - 1);
+    return true;
+  }
+
+  bool face(Fields &fields) {
+    corners.clear();
+    for (auto field = fields.next(); !field.empty(); field = fields.next()) {
+      i64 position, normal;
+      if (!parse_corner(field, position, normal))
+        return false;
+      Corner corner{0, TriangleMesh<double>::NO_NORMAL, false, false};
+      if (!resolve(position, chunk.positions.size(), corner.position,
+                   corner.relative_position) ||
+          (normal != 0 && !resolve(normal, chunk.normals.size(),
+                                   corner.normal, corner.relative_normal)))
+        return false;
+      chunk.has_normals |= normal != 0;
+      corners.push_back(corner);
+    }
+    if (corners.size() < 3)
+      return false;
+    // a fan around the first corner.
+    for (size_t i = 1; i + 1 != corners.size(); ++i) {
+      for (const auto &corner : {corners[0], corners[i], corners[i + 1]}) {
+        if (corner.relative_position)
+          chunk.relative_indices.push_back(chunk.indices.size());
+        if (corner.relative_normal)
+          chunk.relative_normal_indices.push_back(chunk.normal_indices.size());
+        chunk.indices.push_back(corner.position);
+        chunk.normal_indices.push_back(corner.normal);
+      }
+    }
+    return true;
+  }
+
+  bool line(const char *begin, const char *end) {
+    Fields fields(begin, end);
+    const auto keyword = fields.next();
+    if (keyword == "v") {
+      vec3 position;
+      // an optional w or vertex color may follow.
+      if (!fields.vector(position)) {
+        chunk.error = "expected a vertex position";
+        return false;
+      }
+      chunk.positions.push_back(position);
+    } else if (keyword == "vn") {
+      vec3 normal;
+      if (!fields.vector(normal)) {
+        chunk.error = "expected a vertex normal";
+        return false;
+      }
+      chunk.normals.push_back(normal);
+    } else if (keyword == "f") {
+      if (!face(fields)) {
+        chunk.error = "expected a face of at least 3 valid corners";
+        return false;
+      }
+    }
+    // everything else only matters for texturing or grouping.
+    return true;
+  }
+
+public:
+  explicit ChunkParser(Chunk &chunk) : chunk(chunk) {}
+
+  void parse(std::span<const std::byte> bytes) {
+    auto cursor = reinterpret_cast<const char *>(bytes.data());
+    const auto end = cursor + bytes.size();
+    while (cursor != end) {
+      auto newline = static_cast<const char *>(
+          std::memchr(cursor, '\n', static_cast<size_t>(end - cursor)));
+      if (!newline)
+        newline = end;
+      ++chunk.lines;
+      if (!line(cursor, newline)) {
+        chunk.error_line = chunk.lines;
+        return;
+      }
+      cursor = newline == end ? end : newline + 1;
+    }
+  }
+};
+
+// splits the file into `count` pieces that start at the beginning of a line.
+std::vector<std::span<const std::byte>>
+split_lines(std::span<const std::byte> bytes, size_t count) {
+  std::vector<std::span<const std::byte>> pieces;
+  size_t start = 0;
+  for (size_t i = 1; i <= count && start != bytes.size(); ++i) {
+    auto end = i == count ? bytes.size() : bytes.size() / count * i;
+    end = std::max(end, start);
+    while (end != bytes.size() && bytes[end - 1] != std::byte('\n'))
+      ++end;
+    pieces.push_back(bytes.subspan(start, end - start));
+    start = end;
+  }
+  return pieces;
+}
+
+} // namespace
+
+bool load_obj(std::string_view path, TriangleMesh<double> &mesh,
+              size_t thread_count) {
+  Timer timer;
+  utils::MappedFile file;
+  if (!file.open(path)) {
+    objlog.error() << "Could not open " << path << ": "
+                   << std::strerror(errno) << '\n';
+    return false;
+  }
+  const auto bytes = file.bytes();
+  const auto pieces = split_lines(
+      bytes, std::clamp<size_t>(bytes.size() / MIN_CHUNK_SIZE, 1,
+                                std::max<size_t>(thread_count, 1)));
+  std::vector<Chunk> chunks(pieces.size());
+  const auto for_each_chunk = [&](auto &&work) {
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunks.size(); ++i)
+      workers.emplace_back([&, i] { work(i); });
+    if (!chunks.empty())
+      work(0);
+    for (auto &worker : workers)
+      worker.join();
+  };
+  for_each_chunk([&](size_t i) { ChunkParser(chunks[i]).parse(pieces[i]); });
+
+  // where every chunk's elements go in the whole mesh.
+  struct Offsets {
+    size_t positions = 0, normals = 0, indices = 0;
+  };
+  std::vector<Offsets> offsets(chunks.size() + 1);
+  bool has_normals = false;
+  size_t line = 0;
+  for (size_t i = 0; i != chunks.size(); ++i) {
+    const auto &chunk = chunks[i];
+    if (!chunk.error.empty()) {
+      objlog.error() << path << ':' << line + chunk.error_line << ": "
+                     << chunk.error << '\n';
+      return false;
+    }
+    line += chunk.lines;
+    has_normals |= chunk.has_normals;
+    offsets[i + 1] = Offsets{offsets[i].positions + chunk.positions.size(),
+                             offsets[i].normals + chunk.normals.size(),
+                             offsets[i].indices + chunk.indices.size()};
+  }
+  const auto totals = offsets.back();
+  if (totals.indices == 0) {
+    objlog.error() << path << " has no faces\n";
+    return false;
+  }
+  if (totals.positions >= std::numeric_limits<u32>::max() ||
+      totals.normals >= std::numeric_limits<u32>::max() ||
+      totals.indices / 3 >= std::numeric_limits<u32>::max()) {
+    objlog.error() << path << " is too large\n";
+    return false;
+  }
+
+  std::vector<vec3> positions(totals.positions), normals(totals.normals);
+  std::vector<u32> indices(totals.indices);
+  std::vector<u32> normal_indices(has_normals ? totals.indices : 0);
+  std::vector<u8> valid(chunks.size());
+  for_each_chunk([&](size_t i) {
+    auto &chunk = chunks[i];
+    const auto &at = offsets[i];
+    std::copy(chunk.positions.begin(), chunk.positions.end(),
+              positions.begin() + at.positions);
+    std::copy(chunk.normals.begin(), chunk.normals.end(),
+              normals.begin() + at.normals);
+    for (const auto relative : chunk.relative_indices)
+      chunk.indices[relative] += static_cast<u32>(at.positions);
+    for (const auto relative : chunk.relative_normal_indices)
+      chunk.normal_indices[relative] += static_cast<u32>(at.normals);
+    const auto defined_position = [&](u32 index) {
+      return index < totals.positions;
+    };
+    const auto defined_normal = [&](u32 index) {
+      return index == TriangleMesh<double>::NO_NORMAL ||
+             index < totals.normals;
+    };
+    valid[i] = std::all_of(chunk.indices.begin(), chunk.indices.end(),
+                           defined_position) &&
+               std::all_of(chunk.normal_indices.begin(),
+                           chunk.normal_indices.end(), defined_normal);
+    std::copy(chunk.indices.begin(), chunk.indices.end(),
+              indices.begin() + at.indices);
+    if (has_normals)
+      std::copy(chunk.normal_indices.begin(), chunk.normal_indices.end(),
+                normal_indices.begin() + at.indices);
+    chunk = {};
+  });
+  if (std::find(valid.begin(), valid.end(), u8(0)) != valid.end()) {
+    objlog.error() << path << ": a face refers to a vertex or normal that "
+                              "isn't defined\n";
+    return false;
+  }
+
+  mesh.assign(std::move(positions), std::move(normals), std::move(indices),
+              std::move(normal_indices));
+  objlog.info() << "Loaded " << mesh.triangle_count() << " triangles from "
+                << path << " in " << timer.millis() << "ms\n";
+  return true;
+}
+
+} // namespace renderer::ray_tracer
@@ -0,0 +1,16 @@
+#pragma once
+#include "ray_tracer/mesh.h"
+#include <string_view>
+
+namespace renderer::ray_tracer {
+
+// Reads the geometry of a Wavefront OBJ file into `mesh`: vertices (`v`),
+// vertex normals (`vn`) and faces (`f`), with polygons split into fans of
+// triangles. Texture coordinates, groups and materials are ignored. The file
+// is mapped and split into chunks at line boundaries, parsed on
+// `thread_count` threads. Logs and returns false on errors, leaving `mesh` as
+// it was.
+bool load_obj(std::string_view path, TriangleMesh<double> &mesh,
+              size_t thread_count);
+
+} // namespace renderer::ray_tracer
@@ -0,0 +1,72 @@
+#pragma once
+#include "types.h"
+#include <bit>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <type_traits>
+
+namespace renderer::ray_tracer {
+
+// the ray tracer is templated on its scalar type, float or double. Sample
+// points and the accumulated colors stay in double either way.
+template <typename T> using vec3_t = glm::vec<3, T, glm::highp>;
+using vec3 = vec3_t<double>;
+
+// hits nearer than this are ignored so a scattered ray doesn't hit the surface
+// it starts from.
+template <typename T> inline constexpr T MIN_HIT_DISTANCE = T(0.0001);
+// float can't resolve 0.0001 at the coordinates scenes use. Most of the work
+// is done by `spawn_point` instead; this only catches what gets past it.
+template <> inline constexpr float MIN_HIT_DISTANCE<float> = 0.001f;
+
+template <typename T> struct Ray {
+  vec3_t<T> origin;
+  vec3_t<T> direction; // normalized
+  vec3_t<T> at(T t) const noexcept { return origin + t * direction; }
+};
+
+template <typename T> struct Hit {
+  vec3_t<T> point = vec3_t<T>(0);
+  vec3_t<T> normal = vec3_t<T>(0);
+  T selected_t = 0;
+  u32 material = 0; // a `MaterialId`
+  bool front_face = true;
+
+  void make_facing_outwards(const Ray<T> &ray) {
+    if (glm::dot(ray.direction, normal) < T(0)) {
+      front_face = false;
+      normal *= T(-1);
+    }
+  }
+};
+
+// where a ray scattered from `hit` towards `direction` starts. In double the
+// hit point is precise enough on its own. In float the point is pushed off the
+// surface by a few ulps of its own coordinates, on the side the ray leaves
+// towards (Waechter and Binder, "A Fast and Robust Method for Avoiding
+// Self-Intersection"), so it can't hit the surface again however far from
+// the origin it is.
+template <typename T>
+vec3_t<T> spawn_point(const Hit<T> &hit, const vec3_t<T> &direction) noexcept {
+  if constexpr (std::is_same_v<T, double>) {
+    return hit.point;
+  } else {
+    constexpr float ORIGIN = 1.0f / 32.0f;
+    constexpr float FLOAT_SCALE = 1.0f / 65536.0f;
+    constexpr float INT_SCALE = 256.0f;
+    const auto normal =
+        glm::dot(direction, hit.normal) < 0.0f ? -hit.normal : hit.normal;
+    vec3_t<T> result;
+    for (int axis = 0; axis != 3; ++axis) {
+      const auto p = hit.point[axis];
+      const auto offset = static_cast<i32>(INT_SCALE * normal[axis]);
+      const auto bits = std::bit_cast<i32>(p) + (p < 0.0f ? -offset : offset);
+      // near zero the ulps are too small to help, so use a fixed offset.
+      result[axis] = std::abs(p) < ORIGIN ? p + FLOAT_SCALE * normal[axis]
+                                          : std::bit_cast<float>(bits);
+    }
+    return result;
+  }
+}
+
+} // namespace renderer::ray_tracer
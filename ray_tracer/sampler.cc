@@ -0,0 +1,206 @@
+#include "ray_tracer/sampler.h"
+#include <array>
+#include <bit>
+#include <cmath>
+
+namespace renderer::ray_tracer {
+namespace {
+
+constexpr double U32_TO_UNIT = 0x1p-32;
+
+constexpr u32 reverse_bits(u32 x) noexcept {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// Laine-Karras style hash: every bit only depends on the bits below it, so
+// running it over reversed bits is a nested uniform (Owen) scramble.
+constexpr u32 laine_karras_permutation(u32 x, u32 seed) noexcept {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+constexpr u32 owen_scramble(u32 x, u32 seed) noexcept {
+  return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// first two dimensions of the Sobol sequence. Higher dimensions are "padded":
+// every pair of dimensions reuses them with its own index shuffle and
+// scramble, which keeps their 2D stratification.
+constexpr u32 sobol_0(u32 index) noexcept { return reverse_bits(index); }
+constexpr u32 sobol_1(u32 index) noexcept {
+  u32 result = 0;
+  for (u32 v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+    if (index & 1)
+      result ^= v;
+  }
+  return result;
+}
+
+// Kensler's hashed permutation of [0, length).
+constexpr u32 permute(u32 i, u32 length, u32 seed) noexcept {
+  u32 w = length - 1;
+  w |= w >> 1;
+  w |= w >> 2;
+  w |= w >> 4;
+  w |= w >> 8;
+  w |= w >> 16;
+  do {
+    i ^= seed;
+    i *= 0xe170893du;
+    i ^= seed >> 16;
+    i ^= (i & w) >> 4;
+    i ^= seed >> 8;
+    i *= 0x0929eb3fu;
+    i ^= seed >> 23;
+    i ^= (i & w) >> 1;
+    i *= 1 | seed >> 27;
+    i *= 0x6935fa69u;
+    i ^= (i & w) >> 11;
+    i *= 0x74dcb303u;
+    i ^= (i & w) >> 2;
+    i *= 0x9e501cc3u;
+    i ^= (i & w) >> 2;
+    i *= 0xc860a3dfu;
+    i &= w;
+    i ^= i >> 5;
+  } while (i >= length);
+  return (i + seed) % length;
+}
+
+constexpr std::array<u32, 64> PRIMES = {
+    2,   3,   5,   7,   11,  13,  17,  19,  23,  29,  31,  37,  41,
+    43,  47,  53,  59,  61,  67,  71,  73,  79,  83,  89,  97,  101,
+    103, 107, 109, 113, 127, 131, 137, 139, 149, 151, 157, 163, 167,
+    173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229, 233, 239,
+    241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311};
+
+double radical_inverse(u32 base, u64 index) noexcept {
+  const double inverse_base = 1.0 / base;
+  double result = 0.0, factor = inverse_base;
+  while (index) {
+    result += static_cast<double>(index % base) * factor;
+    index /= base;
+    factor *= inverse_base;
+  }
+  return result;
+}
+
+// stays in [0, 1) after a toroidal shift.
+double wrap(double x) noexcept { return x >= 1.0 ? x - 1.0 : x; }
+
+} // namespace
+
+std::optional<SamplerKind> parse_sampler_kind(std::string_view name) noexcept {
+  for (const auto kind : {SamplerKind::Random, SamplerKind::Stratified,
+                          SamplerKind::Halton, SamplerKind::Sobol}) {
+    if (to_string(kind) == name)
+      return kind;
+  }
+  return std::nullopt;
+}
+
+std::string_view to_string(SamplerKind kind) noexcept {
+  switch (kind) {
+  case SamplerKind::Random:
+    return "random";
+  case SamplerKind::Stratified:
+    return "stratified";
+  case SamplerKind::Halton:
+    return "halton";
+  case SamplerKind::Sobol:
+    return "sobol";
+  }
+  return "unknown";
+}
+
+Sampler::Sampler(SamplerKind kind, u64 seed, u64 pixel, u32 sample,
+                 u32 sample_count) noexcept
+    : kind(kind), seed(seed), pixel(pixel), sample(sample),
+      sample_count(sample_count),
+      rand(utils::random::Rng::for_sample(seed, pixel, sample)) {}
+
+u64 Sampler::dimension_key() const noexcept {
+  return utils::random::hash(utils::random::hash(seed, pixel), dimension);
+}
+
+double Sampler::next_1d() noexcept {
+  const auto key = dimension_key();
+  const auto seed32 = static_cast<u32>(key);
+  double value;
+  switch (kind) {
+  case SamplerKind::Stratified:
+    if (sample >= sample_count) {
+      value = rand.next_double();
+      break;
+    }
+    value = (permute(sample, sample_count, seed32) + rand.next_double()) /
+            sample_count;
+    break;
+  case SamplerKind::Halton:
+    if (dimension >= PRIMES.size()) {
+      value = rand.next_double();
+      break;
+    }
+    // Cranley-Patterson rotation per pixel, so neighbours don't share points.
+    value = wrap(radical_inverse(PRIMES[dimension], sample) +
+                 (key >> 11) * 0x1p-53);
+    break;
+  case SamplerKind::Sobol: {
+    const auto index = owen_scramble(sample, static_cast<u32>(key >> 32));
+    value = owen_scramble(sobol_0(index), seed32) * U32_TO_UNIT;
+    break;
+  }
+  case SamplerKind::Random:
+  default:
+    value = rand.next_double();
+    break;
+  }
+  ++dimension;
+  return value;
+}
+
+std::pair<double, double> Sampler::next_2d() noexcept {
+  const auto key = dimension_key();
+  const auto seed32 = static_cast<u32>(key);
+  std::pair<double, double> value;
+  switch (kind) {
+  case SamplerKind::Stratified: {
+    // square grid of strata. Leftover samples are random.
+    const auto side = static_cast<u32>(std::sqrt(sample_count));
+    if (sample >= side * side) {
+      value = {rand.next_double(), rand.next_double()};
+      break;
+    }
+    const auto stratum = permute(sample, side * side, seed32);
+    value = {(stratum % side + rand.next_double()) / side,
+             (stratum / side + rand.next_double()) / side};
+    break;
+  }
+  case SamplerKind::Sobol: {
+    const auto index = owen_scramble(sample, static_cast<u32>(key >> 32));
+    const auto second_seed = static_cast<u32>(utils::random::mix(key));
+    value = {owen_scramble(sobol_0(index), seed32) * U32_TO_UNIT,
+             owen_scramble(sobol_1(index), second_seed) * U32_TO_UNIT};
+    break;
+  }
+  case SamplerKind::Halton:
+  case SamplerKind::Random:
+  default: {
+    const auto x = next_1d();
+    const auto y = next_1d();
+    return {x, y};
+  }
+  }
+  dimension += 2;
+  return value;
+}
+
+} // namespace renderer::ray_tracer
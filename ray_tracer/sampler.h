@@ -0,0 +1,51 @@
+#pragma once
+#include "random.h"
+#include "types.h"
+#include <optional>
+#include <string_view>
+#include <utility>
+
+namespace renderer::ray_tracer {
+
+enum class SamplerKind { Random, Stratified, Halton, Sobol };
+
+std::optional<SamplerKind> parse_sampler_kind(std::string_view name) noexcept;
+std::string_view to_string(SamplerKind kind) noexcept;
+
+// Sample points for a single camera sample. Dimensions are handed out in
+// order: the first two jitter the pixel, then every bounce gets
+// `BOUNCE_DIMENSIONS` of its own (see `start_bounce`), so the same dimension
+// always drives the same decision across all the samples of a pixel.
+class Sampler {
+  SamplerKind kind;
+  u64 seed;
+  u64 pixel;
+  u32 sample;
+  u32 sample_count;
+  u32 dimension = 0;
+  // jitter within strata and fallback for dimensions a sequence doesn't
+  // cover.
+  utils::random::Rng rand;
+
+  u64 dimension_key() const noexcept;
+
+public:
+  static constexpr u32 CAMERA_DIMENSIONS = 2;
+  static constexpr u32 BOUNCE_DIMENSIONS = 3;
+
+  // `sample_count` is the number of samples the pixel is expected to take.
+  // Only the stratified sampler needs it; samples past it fall back to
+  // uniform random points.
+  Sampler(SamplerKind kind, u64 seed, u64 pixel, u32 sample,
+          u32 sample_count) noexcept;
+
+  // moves to the first dimension of bounce `depth`, whatever the previous
+  // bounces consumed.
+  void start_bounce(u32 depth) noexcept {
+    dimension = CAMERA_DIMENSIONS + depth * BOUNCE_DIMENSIONS;
+  }
+  double next_1d() noexcept;
+  std::pair<double, double> next_2d() noexcept;
+};
+
+} // namespace renderer::ray_tracer
@@ -0,0 +1,743 @@
+#include "ray_tracer/scene.h"
+#include "log.h"
+#include "ray_tracer/obj.h"
+#include "ray_tracer/scene_cache.h"
+#include "timer.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+static utils::Log scenelog("scene");
+
+namespace renderer::ray_tracer {
+
+static_assert(sizeof(BinarySceneHeader) == 120 && sizeof(BinarySphere) == 40 &&
+                  sizeof(BinaryMaterial) == 48 && sizeof(BinaryMesh) == 32 &&
+                  sizeof(BinaryInstance) == 104,
+              "binary scene records must not have implicit padding");
+static_assert(sizeof(vec3) == 3 * sizeof(double),
+              "mesh arrays are read and written as double[3]");
+
+void Scene::build_acceleration(size_t thread_count) {
+  // converting every sphere in one tight loop is much faster than adding it
+  // to both worlds as it's read.
+  world_float.spheres = SphereSet<float>();
+  world_float.spheres.reserve(world.spheres.size());
+  for (size_t i = 0; i != world.spheres.size(); ++i) {
+    const auto sphere = world.spheres.at(i);
+    world_float.add(
+        Sphere<float>{vec3_t<float>(sphere.center), float(sphere.radius)},
+        MaterialId{world.spheres.material[i]});
+  }
+  world_float.meshes.clear();
+  for (const auto &mesh : world.meshes) {
+    const auto convert = [](std::span<const vec3> vectors) {
+      return std::vector<vec3_t<float>>(vectors.begin(), vectors.end());
+    };
+    TriangleMesh<float> converted;
+    converted.assign(
+        convert(mesh.positions), convert(mesh.normals),
+        std::vector<u32>(mesh.indices.begin(), mesh.indices.end()),
+        std::vector<u32>(mesh.normal_indices.begin(),
+                         mesh.normal_indices.end()));
+    world_float.add(std::move(converted), MaterialId{mesh.material});
+  }
+  // the inverses are converted too rather than computed again in float.
+  world_float.instances.clear();
+  for (const auto &instance : world.instances) {
+    world_float.instances.push_back(
+        Instance<float>{instance.mesh, instance.material,
+                        instance.object_to_world.cast<float>(),
+                        instance.world_to_object.cast<float>()});
+  }
+  world.build_acceleration(thread_count);
+  world_float.build_acceleration(thread_count);
+}
+
+void SceneLoader::reserve(size_t sphere_count) {
+  scene.world.spheres.reserve(sphere_count);
+}
+
+void SceneLoader::set_camera(const Camera &camera) { scene.camera = camera; }
+
+template <typename T>
+static MaterialId add_to(World<T> &world, const MaterialDesc &material) {
+  const auto albedo = vec3_t<T>(material.albedo);
+  switch (material.kind) {
+  case MaterialKind::Lambertian:
+    return world.materials.add(Lambertian<T>{albedo});
+  case MaterialKind::Metal:
+    return world.materials.add(Metal<T>(albedo, T(material.fuzz)));
+  case MaterialKind::Dielectric:
+    return world.materials.add(Dielectric<T>{T(material.refraction_index)});
+  }
+  return MaterialId{};
+}
+
+u32 SceneLoader::add_material(const MaterialDesc &material) {
+  // both worlds get the same materials in the same order, so the ids match.
+  add_to(scene.world_float, material);
+  return add_to(scene.world, material).value;
+}
+
+void SceneLoader::add_sphere(const Sphere<double> &sphere, u32 material) {
+  scene.world.add(sphere, MaterialId{material});
+}
+
+u32 SceneLoader::add_mesh(TriangleMesh<double> mesh, u32 material) {
+  return scene.world.add(std::move(mesh), MaterialId{material});
+}
+
+void SceneLoader::add_instance(u32 mesh,
+                               const Transform<double> &object_to_world,
+                               u32 material) {
+  scene.world.add(mesh, object_to_world, material);
+}
+
+BinarySceneWriter::BinarySceneWriter(std::string_view path)
+    : path(path), file(this->path, std::ios::binary) {
+  if (!file) {
+    scenelog.error() << "Could not open " << path << " for writing\n";
+    return;
+  }
+  // the header is rewritten by `finish` once the counts are known.
+  const BinarySceneHeader header{};
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+u32 BinarySceneWriter::add_material(const MaterialDesc &material) {
+  materials.push_back(material);
+  return static_cast<u32>(materials.size() - 1);
+}
+
+void BinarySceneWriter::add_sphere(const Sphere<double> &sphere,
+                                   u32 material) {
+  const BinarySphere record{
+      {sphere.center.x, sphere.center.y, sphere.center.z},
+      sphere.radius,
+      material,
+      0};
+  file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+  ++sphere_count;
+}
+
+u32 BinarySceneWriter::add_mesh(TriangleMesh<double> mesh, u32 material) {
+  meshes.emplace_back(std::move(mesh), material);
+  return static_cast<u32>(meshes.size() - 1);
+}
+
+void BinarySceneWriter::add_instance(u32 mesh,
+                                     const Transform<double> &object_to_world,
+                                     u32 material) {
+  BinaryInstance record{mesh, material, {}, {}};
+  for (int i = 0; i != 3; ++i) {
+    for (int k = 0; k != 3; ++k)
+      record.rows[i][k] = object_to_world.rows[i][k];
+    record.translation[i] = object_to_world.translation[i];
+  }
+  instances.push_back(record);
+}
+
+bool BinarySceneWriter::finish() {
+  for (const auto &material : materials) {
+    const BinaryMaterial record{
+        static_cast<u32>(material.kind),
+        0,
+        {material.albedo.x, material.albedo.y, material.albedo.z},
+        material.fuzz,
+        material.refraction_index};
+    file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+  }
+  for (const auto &[mesh, material] : meshes) {
+    const auto write = [&](auto elements) {
+      file.write(reinterpret_cast<const char *>(elements.data()),
+                 static_cast<std::streamsize>(elements.size_bytes()));
+    };
+    const BinaryMesh record{material, !mesh.normal_indices.empty(),
+                            mesh.positions.size(), mesh.normals.size(),
+                            mesh.triangle_count()};
+    file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    write(mesh.positions);
+    write(mesh.normals);
+    write(mesh.indices);
+    write(mesh.normal_indices);
+  }
+  file.write(reinterpret_cast<const char *>(instances.data()),
+             static_cast<std::streamsize>(instances.size() *
+                                          sizeof(BinaryInstance)));
+
+  BinarySceneHeader header{};
+  std::memcpy(header.magic, BinarySceneHeader::MAGIC, sizeof(header.magic));
+  header.version = BinarySceneHeader::VERSION;
+  header.material_count = static_cast<u32>(materials.size());
+  header.sphere_count = sphere_count;
+  for (int axis = 0; axis != 3; ++axis) {
+    header.camera_origin[axis] = camera.origin[axis];
+    header.camera_look_at[axis] = camera.look_at[axis];
+    header.camera_up[axis] = camera.up[axis];
+  }
+  header.viewport_width = camera.viewport_width;
+  header.mesh_count = meshes.size();
+  header.instance_count = instances.size();
+  file.seekp(0);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.close();
+  if (!file) {
+    scenelog.error() << "Could not write scene to " << path << '\n';
+    return false;
+  }
+  return true;
+}
+
+void builtin_scene(SceneBuilder &builder) {
+  const auto sphere = builder.add_material(
+      MaterialDesc{MaterialKind::Lambertian, vec3(0.1, 0.3, 0.5)});
+  const auto floor =
+      builder.add_material(MaterialDesc{MaterialKind::Lambertian, vec3(0.5)});
+  builder.add_sphere(Sphere<double>{vec3(0.0, 0.0, -1.0), 0.5}, sphere);
+  builder.add_sphere(Sphere<double>{vec3(0.0, -100.5, -1.0), 100.0}, floor);
+}
+
+namespace {
+
+// whitespace separated fields of a line of a text scene.
+class Fields {
+  std::string_view rest;
+
+  void skip_space() noexcept {
+    while (!rest.empty() && (rest.front() == ' ' || rest.front() == '\t' ||
+                             rest.front() == '\r'))
+      rest.remove_prefix(1);
+  }
+
+public:
+  explicit Fields(std::string_view line) : rest(line) {
+    // everything after a `#` is a comment.
+    if (const auto comment = rest.find('#'); comment != rest.npos)
+      rest = rest.substr(0, comment);
+  }
+
+  bool empty() noexcept {
+    skip_space();
+    return rest.empty();
+  }
+
+  std::string_view next() noexcept {
+    skip_space();
+    size_t length = 0;
+    while (length != rest.size() && rest[length] != ' ' &&
+           rest[length] != '\t' && rest[length] != '\r')
+      ++length;
+    const auto field = rest.substr(0, length);
+    rest.remove_prefix(length);
+    return field;
+  }
+
+  bool number(double &out) noexcept {
+    const auto field = next();
+    const auto [ptr, err] =
+        std::from_chars(field.data(), field.data() + field.size(), out);
+    return !field.empty() && err == std::errc() &&
+           ptr == field.data() + field.size() && std::isfinite(out);
+  }
+
+  bool vector(vec3 &out) noexcept {
+    return number(out.x) && number(out.y) && number(out.z);
+  }
+};
+
+struct NameHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view name) const noexcept {
+    return std::hash<std::string_view>{}(name);
+  }
+};
+
+class TextSceneReader {
+  std::string_view path;
+  SceneBuilder &builder;
+  size_t thread_count;
+  // material name -> handle from the builder.
+  std::unordered_map<std::string, u32, NameHash, std::equal_to<>> materials;
+  MaterialCounts material_counts;
+  // object name -> mesh handle from the builder.
+  std::unordered_map<std::string, u32, NameHash, std::equal_to<>> objects;
+  size_t line_number = 0;
+
+  bool error(std::string_view message) const {
+    scenelog.error() << path << ':' << line_number << ": " << message << '\n';
+    return false;
+  }
+
+  bool material(std::string_view kind, Fields &fields) {
+    const auto name = fields.next();
+    if (name.empty())
+      return error("expected a material name");
+    MaterialDesc material;
+    if (kind == "lambertian") {
+      material.kind = MaterialKind::Lambertian;
+      if (!fields.vector(material.albedo))
+        return error("expected an albedo");
+    } else if (kind == "metal") {
+      material.kind = MaterialKind::Metal;
+      if (!fields.vector(material.albedo) || !fields.number(material.fuzz))
+        return error("expected an albedo and a fuzz");
+    } else {
+      material.kind = MaterialKind::Dielectric;
+      if (!fields.number(material.refraction_index) ||
+          material.refraction_index <= 0.0)
+        return error("expected a positive refraction index");
+    }
+    if (materials.contains(name))
+      return error("material redefined");
+    if (!material_counts.add(material.kind))
+      return error("too many materials of this kind");
+    materials.emplace(name, builder.add_material(material));
+    return true;
+  }
+
+  // reads `<OBJ file> <material name>` and passes the mesh to the builder.
+  bool mesh(Fields &fields, u32 &handle) {
+    const auto file = fields.next();
+    const auto material = materials.find(fields.next());
+    if (file.empty() || material == materials.end())
+      return error("expected an OBJ file and a known material");
+    // relative to the scene file, not to the working directory.
+    const auto obj_path = std::filesystem::path(path).parent_path() / file;
+    TriangleMesh<double> loaded;
+    if (!load_obj(obj_path.string(), loaded, thread_count))
+      return error("could not load the mesh");
+    handle = builder.add_mesh(std::move(loaded), material->second);
+    return true;
+  }
+
+  bool instance(Fields &fields) {
+    const auto object = objects.find(fields.next());
+    if (object == objects.end())
+      return error("expected a known object");
+    auto material = Instance<double>::MESH_MATERIAL;
+    Transform<double> transform;
+    for (bool first = true; !fields.empty(); first = false) {
+      const auto field = fields.next();
+      Transform<double> step;
+      vec3 value;
+      if (field == "translate") {
+        if (!fields.vector(value))
+          return error("expected an offset");
+        step = Transform<double>::translate(value);
+      } else if (field == "rotate") {
+        double degrees = 0.0;
+        if (!fields.vector(value) || !fields.number(degrees) ||
+            glm::dot(value, value) == 0.0)
+          return error("expected an axis and an angle in degrees");
+        step = Transform<double>::rotate(value, degrees);
+      } else if (field == "scale") {
+        if (!fields.vector(value))
+          return error("expected scale factors");
+        step = Transform<double>::scale(value);
+      } else if (const auto found = materials.find(field);
+                 first && found != materials.end()) {
+        material = found->second;
+        continue;
+      } else {
+        return error("expected a material or a transform");
+      }
+      transform = step * transform;
+    }
+    if (!(std::abs(transform.determinant()) > 0.0))
+      return error("the transform can't be inverted");
+    builder.add_instance(object->second, transform, material);
+    return true;
+  }
+
+  bool line(std::string_view text) {
+    ++line_number;
+    Fields fields(text);
+    if (fields.empty())
+      return true;
+    const auto keyword = fields.next();
+    if (keyword == "sphere") {
+      Sphere<double> sphere;
+      if (!fields.vector(sphere.center) || !fields.number(sphere.radius) ||
+          sphere.radius <= 0.0)
+        return error("expected a center and a positive radius");
+      const auto name = fields.next();
+      const auto material = materials.find(name);
+      if (material == materials.end())
+        return error("unknown material");
+      builder.add_sphere(sphere, material->second);
+    } else if (keyword == "mesh") {
+      u32 handle;
+      if (!mesh(fields, handle))
+        return false;
+      builder.add_instance(handle, Transform<double>(),
+                           Instance<double>::MESH_MATERIAL);
+    } else if (keyword == "object") {
+      const auto name = fields.next();
+      if (name.empty())
+        return error("expected an object name");
+      if (objects.contains(name))
+        return error("object redefined");
+      u32 handle;
+      if (!mesh(fields, handle))
+        return false;
+      objects.emplace(name, handle);
+    } else if (keyword == "instance") {
+      if (!instance(fields))
+        return false;
+    } else if (keyword == "lambertian" || keyword == "metal" ||
+               keyword == "dielectric") {
+      if (!material(keyword, fields))
+        return false;
+    } else if (keyword == "camera") {
+      Camera camera;
+      double fov = 0.0;
+      if (!fields.vector(camera.origin) || !fields.vector(camera.look_at) ||
+          !fields.vector(camera.up) || !fields.number(fov) || fov <= 0.0 ||
+          fov >= 180.0)
+        return error("expected from, at and up points and a field of view "
+                     "between 0 and 180 degrees");
+      camera.viewport_width = 2.0 * std::tan(glm::radians(fov) * 0.5);
+      builder.set_camera(camera);
+    } else {
+      return error("unknown element");
+    }
+    if (!fields.empty())
+      return error("unexpected trailing fields");
+    return true;
+  }
+
+public:
+  TextSceneReader(std::string_view path, SceneBuilder &builder,
+                  size_t thread_count)
+      : path(path), builder(builder), thread_count(thread_count) {}
+
+  // reads the file a chunk at a time, carrying the unfinished last line of a
+  // chunk over to the next.
+  bool read(std::ifstream &file) {
+    constexpr size_t CHUNK_SIZE = size_t(1) << 20;
+    std::vector<char> buffer(CHUNK_SIZE);
+    size_t kept = 0;
+    while (true) {
+      // a line longer than the whole buffer.
+      if (kept == buffer.size())
+        buffer.resize(buffer.size() * 2);
+      file.read(buffer.data() + kept,
+                static_cast<std::streamsize>(buffer.size() - kept));
+      const auto filled = kept + static_cast<size_t>(file.gcount());
+      const bool at_end = !file;
+      size_t start = 0;
+      while (const auto newline = static_cast<const char *>(
+                 std::memchr(buffer.data() + start, '\n', filled - start))) {
+        const auto end = static_cast<size_t>(newline - buffer.data());
+        if (!line({buffer.data() + start, end - start}))
+          return false;
+        start = end + 1;
+      }
+      if (at_end) {
+        if (file.bad()) {
+          scenelog.error() << "Could not read " << path << '\n';
+          return false;
+        }
+        return start == filled ||
+               line({buffer.data() + start, filled - start});
+      }
+      std::memmove(buffer.data(), buffer.data() + start, filled - start);
+      kept = filled - start;
+    }
+  }
+};
+
+// binary records get the checks the text reader makes on the same values:
+// every number finite.
+template <size_t N> bool all_finite(const double (&values)[N]) noexcept {
+  return std::all_of(std::begin(values), std::end(values),
+                     [](double value) { return std::isfinite(value); });
+}
+
+// reads the mesh at the current position of `file`, which is `file_size`
+// bytes long, and adds its handle to `meshes`. `materials` maps the file's
+// materials to the builder's.
+bool read_mesh(std::string_view path, std::ifstream &file, u64 file_size,
+               std::span<const u32> materials, std::vector<u32> &meshes,
+               SceneBuilder &builder) {
+  BinaryMesh record;
+  if (!file.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+    scenelog.error() << path << ": truncated meshes\n";
+    return false;
+  }
+  const auto invalid = [&] {
+    scenelog.error() << path << ": invalid mesh\n";
+    return false;
+  };
+  // checked against what's left of the file before allocating anything.
+  constexpr u64 LIMIT = std::numeric_limits<u32>::max();
+  const auto index_arrays = record.smooth ? 2 : 1;
+  const auto remaining = file_size - static_cast<u64>(file.tellg());
+  if (record.material >= materials.size() || record.triangle_count == 0 ||
+      record.triangle_count >= LIMIT / 3 || record.vertex_count >= LIMIT ||
+      record.normal_count >= LIMIT ||
+      (record.vertex_count + record.normal_count) * sizeof(vec3) +
+              record.triangle_count * 3 * sizeof(u32) * index_arrays >
+          remaining)
+    return invalid();
+
+  std::vector<vec3> positions(record.vertex_count);
+  std::vector<vec3> normals(record.normal_count);
+  std::vector<u32> indices(record.triangle_count * 3);
+  std::vector<u32> normal_indices(record.smooth ? indices.size() : 0);
+  const auto read = [&](auto &elements) {
+    return static_cast<bool>(file.read(
+        reinterpret_cast<char *>(elements.data()),
+        static_cast<std::streamsize>(elements.size() * sizeof(elements[0]))));
+  };
+  if (!read(positions) || !read(normals) || !read(indices) ||
+      !read(normal_indices)) {
+    scenelog.error() << path << ": truncated meshes\n";
+    return false;
+  }
+  if (!std::all_of(indices.begin(), indices.end(),
+                   [&](u32 index) { return index < positions.size(); }) ||
+      !std::all_of(normal_indices.begin(), normal_indices.end(),
+                   [&](u32 index) {
+                     return index == TriangleMesh<double>::NO_NORMAL ||
+                            index < normals.size();
+                   }))
+    return invalid();
+  TriangleMesh<double> mesh;
+  mesh.assign(std::move(positions), std::move(normals), std::move(indices),
+              std::move(normal_indices));
+  meshes.push_back(
+      builder.add_mesh(std::move(mesh), materials[record.material]));
+  return true;
+}
+
+// reads the instances at the current position of `file`. `materials` and
+// `meshes` map the file's materials and meshes to the builder's.
+bool read_instances(std::string_view path, std::ifstream &file, u64 count,
+                    std::span<const u32> materials,
+                    std::span<const u32> meshes, SceneBuilder &builder) {
+  constexpr size_t CHUNK_INSTANCES = size_t(1) << 12;
+  std::vector<BinaryInstance> chunk(CHUNK_INSTANCES);
+  for (u64 first = 0; first < count; first += CHUNK_INSTANCES) {
+    const auto chunk_count =
+        static_cast<size_t>(std::min<u64>(CHUNK_INSTANCES, count - first));
+    if (!file.read(reinterpret_cast<char *>(chunk.data()),
+                   static_cast<std::streamsize>(chunk_count *
+                                                sizeof(BinaryInstance)))) {
+      scenelog.error() << path << ": truncated instances\n";
+      return false;
+    }
+    for (size_t i = 0; i != chunk_count; ++i) {
+      const auto &record = chunk[i];
+      Transform<double> transform;
+      bool finite = true;
+      for (int row = 0; row != 3; ++row) {
+        for (int column = 0; column != 3; ++column) {
+          transform.rows[row][column] = record.rows[row][column];
+          finite &= std::isfinite(record.rows[row][column]);
+        }
+        transform.translation[row] = record.translation[row];
+        finite &= std::isfinite(record.translation[row]);
+      }
+      if (record.mesh >= meshes.size() ||
+          (record.material != BinaryInstance::MESH_MATERIAL &&
+           record.material >= materials.size()) ||
+          !finite || !(std::abs(transform.determinant()) > 0.0)) {
+        scenelog.error() << path << ": invalid instance " << first + i
+                         << '\n';
+        return false;
+      }
+      builder.add_instance(meshes[record.mesh], transform,
+                           record.material == BinaryInstance::MESH_MATERIAL
+                               ? Instance<double>::MESH_MATERIAL
+                               : materials[record.material]);
+    }
+  }
+  return true;
+}
+
+bool read_binary(std::string_view path, std::ifstream &file,
+                 SceneBuilder &builder) {
+  BinarySceneHeader header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+    scenelog.error() << path << ": truncated header\n";
+    return false;
+  }
+  if (header.version != BinarySceneHeader::VERSION) {
+    scenelog.error() << path << ": unsupported version " << header.version
+                     << " (expected " << BinarySceneHeader::VERSION << ")\n";
+    return false;
+  }
+
+  // the counts are checked against the size of the file before anything is
+  // sized from them.
+  file.seekg(0, std::ios::end);
+  const auto file_size = static_cast<u64>(file.tellg());
+  if (!file || file_size < sizeof(header)) {
+    scenelog.error() << "Could not read " << path << '\n';
+    return false;
+  }
+  auto remaining = file_size - sizeof(header);
+  if (header.sphere_count > remaining / sizeof(BinarySphere)) {
+    scenelog.error() << path << ": truncated spheres\n";
+    return false;
+  }
+  remaining -= header.sphere_count * sizeof(BinarySphere);
+  if (header.material_count > remaining / sizeof(BinaryMaterial)) {
+    scenelog.error() << path << ": truncated materials\n";
+    return false;
+  }
+  remaining -= header.material_count * sizeof(BinaryMaterial);
+  if (header.instance_count > remaining / sizeof(BinaryInstance)) {
+    scenelog.error() << path << ": truncated instances\n";
+    return false;
+  }
+
+  // the materials come after the spheres, but the spheres refer to them.
+  file.seekg(static_cast<std::streamoff>(
+      sizeof(header) + header.sphere_count * sizeof(BinarySphere)));
+  std::vector<BinaryMaterial> records(header.material_count);
+  if (!file.read(reinterpret_cast<char *>(records.data()),
+                 static_cast<std::streamsize>(records.size() *
+                                              sizeof(BinaryMaterial)))) {
+    scenelog.error() << path << ": truncated materials\n";
+    return false;
+  }
+  std::vector<u32> materials;
+  materials.reserve(records.size());
+  MaterialCounts counts;
+  for (const auto &record : records) {
+    if (record.kind >= Materials<double>::KIND_COUNT) {
+      scenelog.error() << path << ": unknown material kind " << record.kind
+                       << '\n';
+      return false;
+    }
+    if (!all_finite(record.albedo) || !std::isfinite(record.fuzz) ||
+        !std::isfinite(record.refraction_index) ||
+        (static_cast<MaterialKind>(record.kind) == MaterialKind::Dielectric &&
+         record.refraction_index <= 0.0)) {
+      scenelog.error() << path << ": invalid material " << materials.size()
+                       << '\n';
+      return false;
+    }
+    if (!counts.add(static_cast<MaterialKind>(record.kind))) {
+      scenelog.error() << path << ": too many materials of kind "
+                       << record.kind << '\n';
+      return false;
+    }
+    materials.push_back(builder.add_material(MaterialDesc{
+        static_cast<MaterialKind>(record.kind),
+        vec3(record.albedo[0], record.albedo[1], record.albedo[2]),
+        record.fuzz, record.refraction_index}));
+  }
+
+  if (!all_finite(header.camera_origin) || !all_finite(header.camera_look_at) ||
+      !all_finite(header.camera_up) || !std::isfinite(header.viewport_width) ||
+      header.viewport_width <= 0.0) {
+    scenelog.error() << path << ": invalid camera\n";
+    return false;
+  }
+  Camera camera;
+  camera.origin = vec3(header.camera_origin[0], header.camera_origin[1],
+                       header.camera_origin[2]);
+  camera.look_at = vec3(header.camera_look_at[0], header.camera_look_at[1],
+                        header.camera_look_at[2]);
+  camera.up =
+      vec3(header.camera_up[0], header.camera_up[1], header.camera_up[2]);
+  camera.viewport_width = header.viewport_width;
+  builder.set_camera(camera);
+
+  builder.reserve(header.sphere_count);
+  file.seekg(sizeof(header));
+  constexpr size_t CHUNK_SPHERES = size_t(1) << 15;
+  std::vector<BinarySphere> chunk(CHUNK_SPHERES);
+  for (u64 first = 0; first < header.sphere_count; first += CHUNK_SPHERES) {
+    const auto count = static_cast<size_t>(
+        std::min<u64>(CHUNK_SPHERES, header.sphere_count - first));
+    if (!file.read(reinterpret_cast<char *>(chunk.data()),
+                   static_cast<std::streamsize>(count *
+                                                sizeof(BinarySphere)))) {
+      scenelog.error() << path << ": truncated spheres\n";
+      return false;
+    }
+    for (size_t i = 0; i != count; ++i) {
+      const auto &record = chunk[i];
+      if (record.material >= materials.size() || !all_finite(record.center) ||
+          !std::isfinite(record.radius) || record.radius <= 0.0) {
+        scenelog.error() << path << ": invalid sphere " << first + i << '\n';
+        return false;
+      }
+      builder.add_sphere(
+          Sphere<double>{vec3(record.center[0], record.center[1],
+                              record.center[2]),
+                         record.radius},
+          materials[record.material]);
+    }
+  }
+
+  // the meshes follow the materials, and the instances the meshes.
+  file.seekg(static_cast<std::streamoff>(
+      sizeof(header) + header.sphere_count * sizeof(BinarySphere) +
+      header.material_count * sizeof(BinaryMaterial)));
+  std::vector<u32> meshes;
+  for (u64 i = 0; i != header.mesh_count; ++i) {
+    if (!read_mesh(path, file, file_size, materials, meshes, builder))
+      return false;
+  }
+  return read_instances(path, file, header.instance_count, materials, meshes,
+                        builder);
+}
+
+} // namespace
+
+bool read_scene(std::string_view path, SceneBuilder &builder,
+                size_t thread_count) {
+  std::ifstream file(std::string(path), std::ios::binary);
+  if (!file) {
+    scenelog.error() << "Could not open " << path << '\n';
+    return false;
+  }
+  char magic[sizeof(BinarySceneHeader::MAGIC)] = {};
+  file.read(magic, sizeof(magic));
+  const bool binary =
+      file && std::memcmp(magic, BinarySceneHeader::MAGIC, sizeof(magic)) == 0;
+  file.clear();
+  file.seekg(0);
+  if (binary)
+    return read_binary(path, file, builder);
+  return TextSceneReader(path, builder, thread_count).read(file);
+}
+
+bool load_scene(std::string_view path, Scene &scene, size_t thread_count) {
+  if (is_scene_cache(path))
+    return map_scene_cache(path, scene);
+  Timer timer;
+  Scene loaded;
+  SceneLoader loader(loaded);
+  if (!read_scene(path, loader, thread_count))
+    return false;
+  if (loaded.world.empty()) {
+    scenelog.error() << path << " has no spheres or mesh instances\n";
+    return false;
+  }
+  const auto read_ms = timer.millis();
+  loaded.build_acceleration(thread_count);
+  scenelog.info() << "Loaded " << loaded.world.spheres.size()
+                  << " spheres and " << loaded.world.meshes.size()
+                  << " meshes in " << loaded.world.instances.size()
+                  << " instances from " << path << " in " << read_ms
+                  << "ms, built the BVHs in " << timer.millis() - read_ms
+                  << "ms\n";
+  scene = std::move(loaded);
+  return true;
+}
+
+} // namespace renderer::ray_tracer
@@ -0,0 +1,217 @@
+#pragma once
+#include "mapped_file.h"
+#include "ray_tracer/camera.h"
+#include "ray_tracer/world.h"
+#include "types.h"
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace renderer::ray_tracer {
+
+// Scene files come in two forms, told apart by their first bytes:
+//
+// text, for authoring. One element per line, `#` starts a comment:
+//   camera <from x y z> <at x y z> <up x y z> <horizontal fov in degrees>
+//   lambertian <name> <albedo r g b>
+//   metal <name> <albedo r g b> <fuzz>
+//   dielectric <name> <refraction index>
+//   sphere <center x y z> <radius> <material name>
+//   mesh <OBJ file, relative to the scene file> <material name>
+//   object <name> <OBJ file> <material name>
+//   instance <object name> [material name] [transforms]
+// materials must be declared before the elements using them, and objects
+// before their instances. `mesh` places a mesh as it is; `object` only loads
+// one, to be placed any number of times by `instance`, which may override
+// its material. The transforms are any number of
+//   translate <x y z>
+//   rotate <axis x y z> <degrees>
+//   scale <x y z>
+// applied in the order written.
+//
+// binary, for loading large scenes quickly: a `BinarySceneHeader`, the
+// spheres as `BinarySphere` records, the materials as `BinaryMaterial`
+// records, the meshes, each a `BinaryMesh` followed by its arrays, and then
+// the instances as `BinaryInstance` records, all little endian.
+// `BinarySceneWriter` writes it.
+
+// the kinds of `Materials`, numbered like it so a kind read from a file is
+// the kind of the `MaterialId` it becomes.
+enum class MaterialKind : u32 {
+  Lambertian = Materials<double>::kind_of<ray_tracer::Lambertian<double>>(),
+  Metal = Materials<double>::kind_of<ray_tracer::Metal<double>>(),
+  Dielectric = Materials<double>::kind_of<ray_tracer::Dielectric<double>>(),
+};
+static_assert(Materials<double>::KIND_COUNT == 3,
+              "every material kind needs a `MaterialKind` and a description");
+
+// a material as scene files describe it. Only the fields of its kind are used.
+struct MaterialDesc {
+  MaterialKind kind = MaterialKind::Lambertian;
+  vec3 albedo = vec3(0.5);
+  double fuzz = 0.0;
+  double refraction_index = 1.5;
+};
+
+// counts the materials of each kind a scene adds, so loaders can reject the
+// one that wouldn't get a `MaterialId` of its own.
+class MaterialCounts {
+  size_t counts[Materials<double>::KIND_COUNT] = {};
+
+public:
+  // whether one more material of `kind` still fits, counting it if so.
+  bool add(MaterialKind kind) noexcept {
+    auto &count = counts[static_cast<u32>(kind)];
+    if (count == MaterialId::MAX_PER_KIND)
+      return false;
+    ++count;
+    return true;
+  }
+};
+
+struct BinarySceneHeader {
+  static constexpr char MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+  // bumped on every change to the layout.
+  static constexpr u32 VERSION = 3;
+
+  char magic[8];
+  u32 version;
+  u32 material_count;
+  u64 sphere_count;
+  double camera_origin[3];
+  double camera_look_at[3];
+  double camera_up[3];
+  double viewport_width;
+  u64 mesh_count;
+  u64 instance_count;
+};
+
+struct BinarySphere {
+  double center[3];
+  double radius;
+  u32 material; // index of the material in the file
+  u32 padding;
+};
+
+struct BinaryMaterial {
+  u32 kind; // a `MaterialKind`
+  u32 padding;
+  double albedo[3];
+  double fuzz;
+  double refraction_index;
+};
+
+// followed by `vertex_count` positions and `normal_count` normals as
+// double[3], then three u32 vertex indices per triangle and, if `smooth`, as
+// many normal indices (`TriangleMesh::NO_NORMAL` for corners without one).
+struct BinaryMesh {
+  u32 material; // index of the material in the file
+  u32 smooth;
+  u64 vertex_count;
+  u64 normal_count;
+  u64 triangle_count;
+};
+
+struct BinaryInstance {
+  static constexpr u32 MESH_MATERIAL = ~u32(0);
+
+  u32 mesh;     // index of the mesh in the file
+  u32 material; // index of the material in the file, or `MESH_MATERIAL`
+  // the object to world transform: the rows of its linear part, then the
+  // translation.
+  double rows[3][3];
+  double translation[3];
+};
+
+// receives a scene one element at a time as it's read, so readers never hold
+// more than a chunk of the file.
+class SceneBuilder {
+public:
+  virtual ~SceneBuilder() = default;
+  // how many spheres are coming, when the format knows it up front.
+  virtual void reserve(size_t sphere_count) { (void)sphere_count; }
+  virtual void set_camera(const Camera &camera) = 0;
+  // returns the handle spheres refer to the material by.
+  virtual u32 add_material(const MaterialDesc &material) = 0;
+  virtual void add_sphere(const Sphere<double> &sphere, u32 material) = 0;
+  // returns the handle instances refer to the mesh by. The mesh isn't placed
+  // until it's instanced.
+  virtual u32 add_mesh(TriangleMesh<double> mesh, u32 material) = 0;
+  // `material` is a material handle, or `Instance::MESH_MATERIAL` to keep the
+  // mesh's.
+  virtual void add_instance(u32 mesh, const Transform<double> &object_to_world,
+                            u32 material) = 0;
+};
+
+// the same scene in both precisions, the way the renderer keeps it.
+struct Scene {
+  Camera camera;
+  World<double> world;
+  // its materials are added along with the double ones, its spheres, meshes
+  // and instances are converted from them by `build_acceleration`.
+  World<float> world_float;
+  // the scene cache both worlds read from, if they were mapped from one.
+  utils::MappedFile cache;
+
+  // must be called after the last sphere is added and before rendering.
+  void build_acceleration(size_t thread_count);
+};
+
+// adds everything it receives to a scene.
+class SceneLoader final : public SceneBuilder {
+  Scene &scene;
+
+public:
+  explicit SceneLoader(Scene &scene) : scene(scene) {}
+  void reserve(size_t sphere_count) override;
+  void set_camera(const Camera &camera) override;
+  u32 add_material(const MaterialDesc &material) override;
+  void add_sphere(const Sphere<double> &sphere, u32 material) override;
+  u32 add_mesh(TriangleMesh<double> mesh, u32 material) override;
+  void add_instance(u32 mesh, const Transform<double> &object_to_world,
+                    u32 material) override;
+};
+
+// streams a scene to disk in the binary form. Spheres are written as they
+// come; the materials, the meshes, the instances and the header are written
+// by `finish`.
+class BinarySceneWriter final : public SceneBuilder {
+  std::string path;
+  std::ofstream file;
+  std::vector<MaterialDesc> materials;
+  std::vector<std::pair<TriangleMesh<double>, u32>> meshes;
+  std::vector<BinaryInstance> instances;
+  Camera camera;
+  u64 sphere_count = 0;
+
+public:
+  explicit BinarySceneWriter(std::string_view path);
+  // whether the file could be opened.
+  bool is_open() const noexcept { return file.is_open(); }
+  void set_camera(const Camera &new_camera) override { camera = new_camera; }
+  u32 add_material(const MaterialDesc &material) override;
+  void add_sphere(const Sphere<double> &sphere, u32 material) override;
+  u32 add_mesh(TriangleMesh<double> mesh, u32 material) override;
+  void add_instance(u32 mesh, const Transform<double> &object_to_world,
+                    u32 material) override;
+  // returns false (and logs) if anything failed to write.
+  bool finish();
+};
+
+// a sphere resting on a much larger one, used when no scene file is given.
+void builtin_scene(SceneBuilder &builder);
+
+// reads a scene file of either form into `builder`, loading the meshes of
+// text scenes on `thread_count` threads. Logs and returns false on errors, in
+// which case `builder` may have received part of the scene.
+bool read_scene(std::string_view path, SceneBuilder &builder,
+                size_t thread_count);
+
+// reads a scene file into `scene` and builds its acceleration structures,
+// or maps a scene cache (see scene_cache.h) that has them prebuilt. `scene` is
+// left as it was on errors.
+bool load_scene(std::string_view path, Scene &scene, size_t thread_count);
+
+} // namespace renderer::ray_tracer
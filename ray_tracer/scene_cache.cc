@@ -0,0 +1,368 @@
+#include "ray_tracer/scene_cache.h"
+#include "log.h"
+#include "timer.h"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+static utils::Log cachelog("scene cache");
+
+namespace renderer::ray_tracer {
+
+static_assert(sizeof(SceneCacheHeader) == 344 &&
+                  sizeof(SceneCacheHeader::MeshOffsets) == 80,
+              "scene cache header must not have implicit padding");
+
+namespace {
+
+constexpr u64 ALIGNMENT = 64;
+
+u64 align(u64 offset) noexcept {
+  return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// appends arrays to the file, every one aligned, and tells where they went.
+class CacheWriter {
+  std::ofstream &file;
+  u64 offset;
+
+public:
+  CacheWriter(std::ofstream &file, u64 offset) : file(file), offset(offset) {}
+
+  // `padding` zeroed elements follow the array directly.
+  template <typename E>
+  u64 write(std::span<const E> elements, size_t padding = 0) {
+    static const char zeros[ALIGNMENT] = {};
+    const auto start = align(offset);
+    file.write(zeros, static_cast<std::streamsize>(start - offset));
+    file.write(reinterpret_cast<const char *>(elements.data()),
+               static_cast<std::streamsize>(elements.size_bytes()));
+    const std::vector<E> zeroed(padding);
+    file.write(reinterpret_cast<const char *>(zeroed.data()),
+               static_cast<std::streamsize>(padding * sizeof(E)));
+    offset = start + (elements.size() + padding) * sizeof(E);
+    return start;
+  }
+};
+
+// `material` is where the sphere materials went, which both worlds share.
+template <typename T>
+SceneCacheHeader::WorldOffsets
+write_world(CacheWriter &writer, const World<T> &world, u64 material) {
+  const auto &spheres = world.spheres;
+  // padded to `SceneCacheHeader::PADDING` whatever the padding of this
+  // build.
+  const auto count = spheres.size();
+  const auto padding = SceneCacheHeader::PADDING;
+  SceneCacheHeader::WorldOffsets offsets{};
+  offsets.center_x = writer.write(spheres.center_x.first(count), padding);
+  offsets.center_y = writer.write(spheres.center_y.first(count), padding);
+  offsets.center_z = writer.write(spheres.center_z.first(count), padding);
+  offsets.radius = writer.write(spheres.radius.first(count), padding);
+  offsets.material = material;
+  offsets.nodes = writer.write(world.bvh.nodes);
+  offsets.node_count = world.bvh.nodes.size();
+  offsets.node_size = sizeof(BVHNode<T>);
+
+  std::vector<SceneCacheHeader::MeshOffsets> meshes;
+  for (const auto &mesh : world.meshes) {
+    SceneCacheHeader::MeshOffsets mesh_offsets{};
+    mesh_offsets.positions = writer.write(mesh.positions);
+    mesh_offsets.normals = writer.write(mesh.normals);
+    mesh_offsets.indices = writer.write(mesh.indices);
+    mesh_offsets.normal_indices = writer.write(mesh.normal_indices);
+    mesh_offsets.nodes = writer.write(mesh.bvh.nodes);
+    mesh_offsets.vertex_count = mesh.positions.size();
+    mesh_offsets.normal_count = mesh.normals.size();
+    mesh_offsets.triangle_count = mesh.triangle_count();
+    mesh_offsets.node_count = mesh.bvh.nodes.size();
+    mesh_offsets.material = mesh.material;
+    mesh_offsets.smooth = !mesh.normal_indices.empty();
+    meshes.push_back(mesh_offsets);
+  }
+  offsets.meshes =
+      writer.write(std::span<const SceneCacheHeader::MeshOffsets>(meshes));
+  offsets.instances =
+      writer.write(std::span<const Instance<T>>(world.instances));
+  offsets.instance_nodes = writer.write(world.instance_bvh.nodes);
+  offsets.instance_node_count = world.instance_bvh.nodes.size();
+  offsets.instance_size = sizeof(Instance<T>);
+  return offsets;
+}
+
+template <size_t I>
+void collect_materials(const Materials<double> &table,
+                       std::vector<BinaryMaterial> &out) {
+  for (const auto &material : table.of_kind<I>()) {
+    using Kind = std::decay_t<decltype(material)>;
+    BinaryMaterial record{};
+    record.kind = static_cast<u32>(I);
+    if constexpr (std::is_same_v<Kind, Lambertian<double>>) {
+      record.albedo[0] = material.albedo.x;
+      record.albedo[1] = material.albedo.y;
+      record.albedo[2] = material.albedo.z;
+    } else if constexpr (std::is_same_v<Kind, Metal<double>>) {
+      record.albedo[0] = material.albedo.x;
+      record.albedo[1] = material.albedo.y;
+      record.albedo[2] = material.albedo.z;
+      record.fuzz = material.fuzz;
+    } else {
+      static_assert(std::is_same_v<Kind, Dielectric<double>>,
+                    "the cache doesn't know how to store this material");
+      record.refraction_index = material.refraction_index;
+    }
+    out.push_back(record);
+  }
+  if constexpr (I + 1 < Materials<double>::KIND_COUNT)
+    collect_materials<I + 1>(table, out);
+}
+
+// points `out` at the `count` elements of `E` at `offset`. Fails if they
+// don't fit in the file or aren't aligned.
+template <typename E>
+bool view(std::span<const std::byte> file, u64 offset, u64 count,
+          std::span<const E> &out) {
+  if (offset % ALIGNMENT != 0 || offset > file.size() ||
+      count > (file.size() - offset) / sizeof(E))
+    return false;
+  out = {reinterpret_cast<const E *>(file.data() + offset),
+         static_cast<size_t>(count)};
+  return true;
+}
+
+template <typename T>
+bool map_mesh(std::span<const std::byte> file,
+              const SceneCacheHeader::MeshOffsets &offsets,
+              const Materials<T> &materials, bool verify,
+              TriangleMesh<T> &mesh) {
+  std::span<const vec3_t<T>> positions, normals;
+  std::span<const u32> indices, normal_indices;
+  std::span<const BVHNode<T>> nodes;
+  // keeps the index counts below from overflowing.
+  if (offsets.triangle_count > file.size())
+    return false;
+  if (!view(file, offsets.positions, offsets.vertex_count, positions) ||
+      !view(file, offsets.normals, offsets.normal_count, normals) ||
+      !view(file, offsets.indices, offsets.triangle_count * 3, indices) ||
+      !view(file, offsets.normal_indices,
+            offsets.smooth ? offsets.triangle_count * 3 : 0, normal_indices) ||
+      !view(file, offsets.nodes, offsets.node_count, nodes))
+    return false;
+  if (!materials.contains(MaterialId{offsets.material}))
+    return false;
+  mesh.borrow(positions, normals, indices, normal_indices);
+  mesh.bvh.borrow(nodes);
+  mesh.material = offsets.material;
+  if (!verify)
+    return true;
+  // rays follow the indices and nodes without checks.
+  for (const auto index : indices) {
+    if (index >= positions.size())
+      return false;
+  }
+  for (const auto index : normal_indices) {
+    if (index != TriangleMesh<T>::NO_NORMAL && index >= normals.size())
+      return false;
+  }
+  return mesh.bvh.valid(offsets.triangle_count);
+}
+
+template <typename T>
+bool map_world(std::span<const std::byte> file,
+               const SceneCacheHeader &header,
+               const SceneCacheHeader::WorldOffsets &offsets, bool verify,
+               World<T> &world) {
+  const auto sphere_count = header.sphere_count;
+  if (offsets.node_size != sizeof(BVHNode<T>) ||
+      offsets.instance_size != sizeof(Instance<T>))
+    return false;
+  const auto padded = sphere_count + SceneCacheHeader::PADDING;
+  std::span<const T> center_x, center_y, center_z, radius;
+  std::span<const u32> material;
+  std::span<const BVHNode<T>> nodes;
+  if (!view(file, offsets.center_x, padded, center_x) ||
+      !view(file, offsets.center_y, padded, center_y) ||
+      !view(file, offsets.center_z, padded, center_z) ||
+      !view(file, offsets.radius, padded, radius) ||
+      !view(file, offsets.material, padded, material) ||
+      !view(file, offsets.nodes, offsets.node_count, nodes))
+    return false;
+  world.spheres.borrow(center_x, center_y, center_z, radius, material,
+                       static_cast<size_t>(sphere_count));
+  world.bvh.borrow(nodes);
+  if (verify && !world.bvh.valid(static_cast<size_t>(sphere_count)))
+    return false;
+
+  std::span<const SceneCacheHeader::MeshOffsets> meshes;
+  if (!view(file, offsets.meshes, header.mesh_count, meshes))
+    return false;
+  for (const auto &mesh_offsets : meshes) {
+    TriangleMesh<T> mesh;
+    if (!map_mesh(file, mesh_offsets, world.materials, verify, mesh))
+      return false;
+    world.meshes.push_back(std::move(mesh));
+  }
+
+  std::span<const Instance<T>> instances;
+  std::span<const BVHNode<T>> instance_nodes;
+  if (!view(file, offsets.instances, header.instance_count, instances) ||
+      !view(file, offsets.instance_nodes, offsets.instance_node_count,
+            instance_nodes))
+    return false;
+  for (const auto &instance : instances) {
+    if (instance.mesh >= header.mesh_count ||
+        (instance.material != Instance<T>::MESH_MATERIAL &&
+         !world.materials.contains(MaterialId{instance.material})))
+      return false;
+  }
+  world.instances.assign(instances.begin(), instances.end());
+  world.instance_bvh.borrow(instance_nodes);
+  return world.instance_bvh.valid(instances.size());
+}
+
+} // namespace
+
+bool write_scene_cache(std::string_view path, const Scene &scene) {
+  std::ofstream file(std::string(path), std::ios::binary);
+  if (!file) {
+    cachelog.error() << "Could not open " << path << " for writing\n";
+    return false;
+  }
+  SceneCacheHeader header{};
+  std::memcpy(header.magic, SceneCacheHeader::MAGIC, sizeof(header.magic));
+  header.version = SceneCacheHeader::VERSION;
+  header.sphere_count = scene.world.spheres.size();
+  for (int axis = 0; axis != 3; ++axis) {
+    header.camera_origin[axis] = scene.camera.origin[axis];
+    header.camera_look_at[axis] = scene.camera.look_at[axis];
+    header.camera_up[axis] = scene.camera.up[axis];
+  }
+  header.viewport_width = scene.camera.viewport_width;
+
+  // the header goes last, once every offset is known.
+  file.seekp(sizeof(header));
+  CacheWriter writer(file, sizeof(header));
+  const auto &spheres = scene.world.spheres;
+  const auto material = writer.write(spheres.material.first(spheres.size()),
+                                     SceneCacheHeader::PADDING);
+  header.world = write_world(writer, scene.world, material);
+  header.world_float = write_world(writer, scene.world_float, material);
+  std::vector<BinaryMaterial> materials;
+  collect_materials<0>(scene.world.materials, materials);
+  header.materials = writer.write(std::span<const BinaryMaterial>(materials));
+  header.material_count = materials.size();
+  header.mesh_count = scene.world.meshes.size();
+  header.instance_count = scene.world.instances.size();
+  file.seekp(0);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.close();
+  if (!file) {
+    cachelog.error() << "Could not write the scene cache to " << path << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool is_scene_cache(std::string_view path) {
+  std::ifstream file(std::string(path), std::ios::binary);
+  char magic[sizeof(SceneCacheHeader::MAGIC)] = {};
+  return file.read(magic, sizeof(magic)) &&
+         std::memcmp(magic, SceneCacheHeader::MAGIC, sizeof(magic)) == 0;
+}
+
+bool map_scene_cache(std::string_view path, Scene &scene, bool verify) {
+  Timer timer;
+  utils::MappedFile cache;
+  if (!cache.open(path)) {
+    cachelog.error() << "Could not map " << path << ": "
+                     << std::strerror(errno) << '\n';
+    return false;
+  }
+  const auto bytes = cache.bytes();
+  SceneCacheHeader header;
+  if (bytes.size() < sizeof(header)) {
+    cachelog.error() << path << ": truncated header\n";
+    return false;
+  }
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  if (std::memcmp(header.magic, SceneCacheHeader::MAGIC,
+                  sizeof(header.magic)) != 0 ||
+      header.version != SceneCacheHeader::VERSION) {
+    cachelog.error() << path << " is not a version "
+                     << SceneCacheHeader::VERSION
+                     << " scene cache. Rebuild it from the scene.\n";
+    return false;
+  }
+  if ((header.sphere_count == 0 && header.instance_count == 0) ||
+      header.sphere_count >= SphereSet<double>::NO_SPHERE) {
+    cachelog.error() << path << ": invalid sphere or instance count\n";
+    return false;
+  }
+
+  Scene mapped;
+  mapped.camera.origin = vec3(header.camera_origin[0],
+                              header.camera_origin[1],
+                              header.camera_origin[2]);
+  mapped.camera.look_at = vec3(header.camera_look_at[0],
+                               header.camera_look_at[1],
+                               header.camera_look_at[2]);
+  mapped.camera.up =
+      vec3(header.camera_up[0], header.camera_up[1], header.camera_up[2]);
+  mapped.camera.viewport_width = header.viewport_width;
+
+  std::span<const BinaryMaterial> materials;
+  if (!view(bytes, header.materials, header.material_count, materials)) {
+    cachelog.error() << path << ": truncated materials\n";
+    return false;
+  }
+  SceneLoader loader(mapped);
+  MaterialCounts counts;
+  for (const auto &record : materials) {
+    if (record.kind >= Materials<double>::KIND_COUNT) {
+      cachelog.error() << path << ": unknown material kind " << record.kind
+                       << '\n';
+      return false;
+    }
+    if (!counts.add(static_cast<MaterialKind>(record.kind))) {
+      cachelog.error() << path << ": too many materials of kind "
+                       << record.kind << '\n';
+      return false;
+    }
+    loader.add_material(MaterialDesc{
+        static_cast<MaterialKind>(record.kind),
+        vec3(record.albedo[0], record.albedo[1], record.albedo[2]),
+        record.fuzz, record.refraction_index});
+  }
+
+  // the worlds share their sphere materials, so they're checked once.
+  const auto sphere_materials_valid = [&] {
+    const auto &spheres = mapped.world.spheres;
+    for (const auto id : spheres.material.first(spheres.size())) {
+      if (!mapped.world.materials.contains(MaterialId{id}))
+        return false;
+    }
+    return true;
+  };
+  if (header.world_float.material != header.world.material ||
+      !map_world(bytes, header, header.world, verify, mapped.world) ||
+      !map_world(bytes, header, header.world_float, verify,
+                 mapped.world_float) ||
+      (verify && !sphere_materials_valid())) {
+    cachelog.error() << path
+                     << " is damaged or was written by an incompatible "
+                        "build. Rebuild it from the scene.\n";
+    return false;
+  }
+  mapped.cache = std::move(cache);
+  cachelog.info() << "Mapped " << header.sphere_count << " spheres and "
+                  << header.mesh_count << " meshes in "
+                  << header.instance_count << " instances from " << path
+                  << " in " << timer.millis() << "ms\n";
+  scene = std::move(mapped);
+  return true;
+}
+
+} // namespace renderer::ray_tracer
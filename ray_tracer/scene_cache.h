@@ -0,0 +1,78 @@
+#pragma once
+#include "ray_tracer/scene.h"
+#include "types.h"
+#include <string_view>
+
+namespace renderer::ray_tracer {
+
+// A scene cache is a built `Scene` written out as it sits in memory: the
+// padded sphere arrays, the mesh arrays, the instances and the BVH nodes of
+// both worlds, each starting on a 64 byte boundary at the offset the header
+// gives. Nothing in it depends on where it's loaded, so `map_scene_cache`
+// maps the file and points the worlds straight at it. Only the materials and
+// the instances, which are small and may be moved, are copied. Both worlds
+// share one array of sphere materials. The file is only readable by builds
+// with the same node layout and byte order as the one that wrote it.
+struct SceneCacheHeader {
+  static constexpr char MAGIC[8] = {'R', 'T', 'C', 'A', 'C', 'H', 'E', '\0'};
+  // bumped on every change to the layout.
+  static constexpr u32 VERSION = 4;
+  // elements after the last sphere of every array, enough for any `LANES`.
+  static constexpr u32 PADDING = 15;
+
+  // where one world's arrays start, from the start of the file.
+  struct WorldOffsets {
+    u64 center_x, center_y, center_z, radius, material;
+    u64 nodes;
+    u64 node_count;
+    u32 node_size; // sizeof(BVHNode<T>)
+    u32 padding;
+    u64 meshes; // `mesh_count` `MeshOffsets`
+    u64 instances; // `instance_count` `Instance<T>`s
+    u64 instance_nodes;
+    u64 instance_node_count;
+    u32 instance_size; // sizeof(Instance<T>)
+    u32 instance_padding;
+  };
+
+  // where one mesh of a world has its arrays.
+  struct MeshOffsets {
+    u64 positions, normals, indices, normal_indices, nodes;
+    u64 vertex_count, normal_count, triangle_count, node_count;
+    u32 material; // a `MaterialId`
+    u32 smooth;   // whether there are normal indices
+  };
+
+  char magic[8];
+  u32 version;
+  u32 padding;
+  u64 sphere_count;
+  double camera_origin[3];
+  double camera_look_at[3];
+  double camera_up[3];
+  double viewport_width;
+  WorldOffsets world;
+  WorldOffsets world_float;
+  u64 materials; // `material_count` `BinaryMaterial`s
+  u64 material_count;
+  u64 mesh_count;
+  u64 instance_count;
+};
+
+// writes `scene`, which must have its acceleration structures built.
+bool write_scene_cache(std::string_view path, const Scene &scene);
+
+// whether `path` starts like a scene cache.
+bool is_scene_cache(std::string_view path);
+
+// maps the cache at `path` and makes `scene` read from it. `scene` keeps the
+// mapping open. It's left as it was on errors.
+// Mapping only checks the header, the offsets, the materials and the
+// instances, so it stays quick and leaves the pages to be read as rays reach
+// them. `verify` also checks every sphere material id, triangle index and
+// BVH node. That reads the whole file, but a damaged cache is then rejected
+// instead of being read out of bounds while rendering.
+bool map_scene_cache(std::string_view path, Scene &scene,
+                     bool verify = false);
+
+} // namespace renderer::ray_tracer
@@ -0,0 +1,407 @@
+#include "ray_tracer/spheres.h"
+#include <limits>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace renderer::ray_tracer {
+namespace {
+
+// distance along the ray to the sphere centered `ca` away from the origin, or
+// a value <= MIN_HIT_DISTANCE if there is none. The nearest solution in front
+// of the ray wins; the far one is only used when the ray starts inside the
+// sphere.
+template <typename T>
+T solve(const vec3_t<T> &ca, const vec3_t<T> &direction, T radius) noexcept {
+  const auto h = glm::dot(ca, direction);
+  T discriminant;
+  if constexpr (std::is_same_v<T, float>) {
+    // h * h - c cancels catastrophically in float for large spheres. The
+    // squared distance from the center to the ray's line doesn't.
+    const auto f = ca - h * direction;
+    discriminant = radius * radius - glm::dot(f, f);
+  } else {
+    discriminant = h * h - (glm::dot(ca, ca) - radius * radius);
+  }
+  // cannot solve the square root
+  if (discriminant < T(0))
+    return T(0);
+  const auto dsqrt = std::sqrt(discriminant);
+  const auto t_near = -h - dsqrt;
+  return t_near > MIN_HIT_DISTANCE<T> ? t_near : dsqrt - h;
+}
+
+} // namespace
+
+template <typename T>
+bool Sphere<T>::intersect(Ray<T> ray, Hit<T> &hit) const noexcept {
+  const auto t = solve(ray.origin - center, ray.direction, radius);
+  // NOTE: the ray doesn't hit if it's tangent.
+  if (t <= MIN_HIT_DISTANCE<T>)
+    return false;
+
+  const auto point = ray.at(t);
+  const auto normal = glm::normalize(point - center);
+  hit = Hit<T>{point, normal, t};
+  return true;
+}
+
+template <typename T> void SphereSet<T>::view_own_arrays() noexcept {
+  center_x = own_center_x;
+  center_y = own_center_y;
+  center_z = own_center_z;
+  radius = own_radius;
+  material = own_material;
+}
+
+template <typename T> void SphereSet<T>::reserve(size_t capacity) {
+  const auto padded = capacity + LANES - 1;
+  own_center_x.reserve(padded);
+  own_center_y.reserve(padded);
+  own_center_z.reserve(padded);
+  own_radius.reserve(padded);
+  own_material.reserve(padded);
+  view_own_arrays();
+}
+
+template <typename T>
+void SphereSet<T>::add(const Sphere<T> &sphere, u32 material_index) {
+  const auto padded = count + 1 + LANES - 1;
+  own_center_x.resize(padded);
+  own_center_y.resize(padded);
+  own_center_z.resize(padded);
+  own_radius.resize(padded);
+  own_material.resize(padded);
+  own_center_x[count] = sphere.center.x;
+  own_center_y[count] = sphere.center.y;
+  own_center_z[count] = sphere.center.z;
+  own_radius[count] = sphere.radius;
+  own_material[count] = material_index;
+  ++count;
+  view_own_arrays();
+}
+
+template <typename T> Sphere<T> SphereSet<T>::at(size_t index) const noexcept {
+  return Sphere<T>{
+      vec3_t<T>(center_x[index], center_y[index], center_z[index]),
+      radius[index]};
+}
+
+template <typename T> void SphereSet<T>::reorder(std::span<const u32> order) {
+  const auto permute = [&](auto &array) {
+    auto reordered = array;
+    for (size_t i = 0; i != order.size(); ++i)
+      reordered[i] = array[order[i]];
+    array = std::move(reordered);
+  };
+  permute(own_center_x);
+  permute(own_center_y);
+  permute(own_center_z);
+  permute(own_radius);
+  permute(own_material);
+  view_own_arrays();
+}
+
+template <typename T>
+void SphereSet<T>::borrow(std::span<const T> new_center_x,
+                          std::span<const T> new_center_y,
+                          std::span<const T> new_center_z,
+                          std::span<const T> new_radius,
+                          std::span<const u32> new_material, size_t new_count) {
+  own_center_x = {};
+  own_center_y = {};
+  own_center_z = {};
+  own_radius = {};
+  own_material = {};
+  center_x = new_center_x;
+  center_y = new_center_y;
+  center_z = new_center_z;
+  radius = new_radius;
+  material = new_material;
+  count = new_count;
+}
+
+#if defined(__AVX512F__)
+template <>
+bool SphereSet<double>::intersect(const Ray<double> &ray, u32 first, u32 end,
+                                  double &closest,
+                                  u32 &closest_index) const noexcept {
+  const auto ox = _mm512_set1_pd(ray.origin.x);
+  const auto oy = _mm512_set1_pd(ray.origin.y);
+  const auto oz = _mm512_set1_pd(ray.origin.z);
+  const auto dx = _mm512_set1_pd(ray.direction.x);
+  const auto dy = _mm512_set1_pd(ray.direction.y);
+  const auto dz = _mm512_set1_pd(ray.direction.z);
+  const auto t_min = _mm512_set1_pd(MIN_HIT_DISTANCE<double>);
+  const auto last = _mm512_set1_epi64(end);
+
+  auto best_t = _mm512_set1_pd(closest);
+  auto best_index = _mm512_set1_epi64(NO_SPHERE);
+  auto index = _mm512_add_epi64(_mm512_set1_epi64(first),
+                                _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0));
+  for (auto i = first; i < end; i += LANES) {
+    const auto cax = _mm512_sub_pd(ox, _mm512_loadu_pd(&center_x[i]));
+    const auto cay = _mm512_sub_pd(oy, _mm512_loadu_pd(&center_y[i]));
+    const auto caz = _mm512_sub_pd(oz, _mm512_loadu_pd(&center_z[i]));
+    const auto r = _mm512_loadu_pd(&radius[i]);
+    const auto h = _mm512_fmadd_pd(
+        cax, dx, _mm512_fmadd_pd(cay, dy, _mm512_mul_pd(caz, dz)));
+    const auto c = _mm512_fmadd_pd(
+        cax, cax,
+        _mm512_fmadd_pd(cay, cay,
+                        _mm512_fmsub_pd(caz, caz, _mm512_mul_pd(r, r))));
+    const auto discriminant = _mm512_fmsub_pd(h, h, c);
+    const auto solvable =
+        _mm512_cmp_pd_mask(discriminant, _mm512_setzero_pd(), _CMP_GE_OQ);
+    const auto dsqrt = _mm512_sqrt_pd(discriminant);
+    const auto t_near =
+        _mm512_sub_pd(_mm512_sub_pd(_mm512_setzero_pd(), h), dsqrt);
+    const auto t_far = _mm512_sub_pd(dsqrt, h);
+    const auto near_valid = _mm512_cmp_pd_mask(t_near, t_min, _CMP_GT_OQ);
+    const auto t = _mm512_mask_blend_pd(near_valid, t_far, t_near);
+    const auto closer = solvable &
+                        _mm512_cmp_pd_mask(t, t_min, _CMP_GT_OQ) &
+                        _mm512_cmp_pd_mask(t, best_t, _CMP_LT_OQ) &
+                        _mm512_cmplt_epi64_mask(index, last);
+    best_t = _mm512_mask_blend_pd(closer, best_t, t);
+    best_index = _mm512_mask_blend_epi64(closer, best_index, index);
+    index = _mm512_add_epi64(index, _mm512_set1_epi64(LANES));
+  }
+
+  alignas(64) double ts[LANES];
+  alignas(64) u64 indices[LANES];
+  _mm512_store_pd(ts, best_t);
+  _mm512_store_si512(indices, best_index);
+  bool did_hit = false;
+  for (size_t lane = 0; lane != LANES; ++lane) {
+    if (indices[lane] != NO_SPHERE && ts[lane] < closest) {
+      closest = ts[lane];
+      closest_index = static_cast<u32>(indices[lane]);
+      did_hit = true;
+    }
+  }
+  return did_hit;
+}
+
+template <>
+bool SphereSet<float>::intersect(const Ray<float> &ray, u32 first, u32 end,
+                                 float &closest,
+                                 u32 &closest_index) const noexcept {
+  const auto ox = _mm512_set1_ps(ray.origin.x);
+  const auto oy = _mm512_set1_ps(ray.origin.y);
+  const auto oz = _mm512_set1_ps(ray.origin.z);
+  const auto dx = _mm512_set1_ps(ray.direction.x);
+  const auto dy = _mm512_set1_ps(ray.direction.y);
+  const auto dz = _mm512_set1_ps(ray.direction.z);
+  const auto t_min = _mm512_set1_ps(MIN_HIT_DISTANCE<float>);
+  const auto last = _mm512_set1_epi32(static_cast<int>(end));
+
+  auto best_t = _mm512_set1_ps(closest);
+  auto best_index = _mm512_set1_epi32(static_cast<int>(NO_SPHERE));
+  auto index = _mm512_add_epi32(
+      _mm512_set1_epi32(static_cast<int>(first)),
+      _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+  for (auto i = first; i < end; i += LANES) {
+    const auto cax = _mm512_sub_ps(ox, _mm512_loadu_ps(&center_x[i]));
+    const auto cay = _mm512_sub_ps(oy, _mm512_loadu_ps(&center_y[i]));
+    const auto caz = _mm512_sub_ps(oz, _mm512_loadu_ps(&center_z[i]));
+    const auto r = _mm512_loadu_ps(&radius[i]);
+    const auto h = _mm512_fmadd_ps(
+        cax, dx, _mm512_fmadd_ps(cay, dy, _mm512_mul_ps(caz, dz)));
+    // distance from the center to the ray's line, see `solve`.
+    const auto fx = _mm512_fnmadd_ps(h, dx, cax);
+    const auto fy = _mm512_fnmadd_ps(h, dy, cay);
+    const auto fz = _mm512_fnmadd_ps(h, dz, caz);
+    const auto discriminant = _mm512_fnmadd_ps(
+        fx, fx,
+        _mm512_fnmadd_ps(fy, fy,
+                         _mm512_fnmadd_ps(fz, fz, _mm512_mul_ps(r, r))));
+    const auto solvable =
+        _mm512_cmp_ps_mask(discriminant, _mm512_setzero_ps(), _CMP_GE_OQ);
+    const auto dsqrt = _mm512_sqrt_ps(discriminant);
+    const auto t_near =
+        _mm512_sub_ps(_mm512_sub_ps(_mm512_setzero_ps(), h), dsqrt);
+    const auto t_far = _mm512_sub_ps(dsqrt, h);
+    const auto near_valid = _mm512_cmp_ps_mask(t_near, t_min, _CMP_GT_OQ);
+    const auto t = _mm512_mask_blend_ps(near_valid, t_far, t_near);
+    const auto closer = solvable &
+                        _mm512_cmp_ps_mask(t, t_min, _CMP_GT_OQ) &
+                        _mm512_cmp_ps_mask(t, best_t, _CMP_LT_OQ) &
+                        _mm512_cmplt_epi32_mask(index, last);
+    best_t = _mm512_mask_blend_ps(closer, best_t, t);
+    best_index = _mm512_mask_blend_epi32(closer, best_index, index);
+    index = _mm512_add_epi32(index, _mm512_set1_epi32(LANES));
+  }
+
+  alignas(64) float ts[LANES];
+  alignas(64) u32 indices[LANES];
+  _mm512_store_ps(ts, best_t);
+  _mm512_store_si512(indices, best_index);
+  bool did_hit = false;
+  for (size_t lane = 0; lane != LANES; ++lane) {
+    if (indices[lane] != NO_SPHERE && ts[lane] < closest) {
+      closest = ts[lane];
+      closest_index = indices[lane];
+      did_hit = true;
+    }
+  }
+  return did_hit;
+}
+#elif defined(__AVX2__)
+template <>
+bool SphereSet<double>::intersect(const Ray<double> &ray, u32 first, u32 end,
+                                  double &closest,
+                                  u32 &closest_index) const noexcept {
+  const auto ox = _mm256_set1_pd(ray.origin.x);
+  const auto oy = _mm256_set1_pd(ray.origin.y);
+  const auto oz = _mm256_set1_pd(ray.origin.z);
+  const auto dx = _mm256_set1_pd(ray.direction.x);
+  const auto dy = _mm256_set1_pd(ray.direction.y);
+  const auto dz = _mm256_set1_pd(ray.direction.z);
+  const auto t_min = _mm256_set1_pd(MIN_HIT_DISTANCE<double>);
+  const auto zero = _mm256_setzero_pd();
+  // lane indices are kept as doubles so they can share the blends with `t`.
+  const auto last = _mm256_set1_pd(end);
+
+  auto best_t = _mm256_set1_pd(closest);
+  auto best_index = _mm256_set1_pd(-1.0);
+  auto index = _mm256_add_pd(_mm256_set1_pd(first),
+                             _mm256_setr_pd(0.0, 1.0, 2.0, 3.0));
+  for (auto i = first; i < end; i += LANES) {
+    const auto cax = _mm256_sub_pd(ox, _mm256_loadu_pd(&center_x[i]));
+    const auto cay = _mm256_sub_pd(oy, _mm256_loadu_pd(&center_y[i]));
+    const auto caz = _mm256_sub_pd(oz, _mm256_loadu_pd(&center_z[i]));
+    const auto r = _mm256_loadu_pd(&radius[i]);
+    const auto h = _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(cax, dx), _mm256_mul_pd(cay, dy)),
+        _mm256_mul_pd(caz, dz));
+    const auto c = _mm256_sub_pd(
+        _mm256_add_pd(
+            _mm256_add_pd(_mm256_mul_pd(cax, cax), _mm256_mul_pd(cay, cay)),
+            _mm256_mul_pd(caz, caz)),
+        _mm256_mul_pd(r, r));
+    const auto discriminant = _mm256_sub_pd(_mm256_mul_pd(h, h), c);
+    const auto solvable = _mm256_cmp_pd(discriminant, zero, _CMP_GE_OQ);
+    const auto dsqrt = _mm256_sqrt_pd(discriminant);
+    const auto t_near = _mm256_sub_pd(_mm256_sub_pd(zero, h), dsqrt);
+    const auto t_far = _mm256_sub_pd(dsqrt, h);
+    const auto t = _mm256_blendv_pd(t_far, t_near,
+                                    _mm256_cmp_pd(t_near, t_min, _CMP_GT_OQ));
+    const auto closer = _mm256_and_pd(
+        _mm256_and_pd(solvable, _mm256_cmp_pd(t, t_min, _CMP_GT_OQ)),
+        _mm256_and_pd(_mm256_cmp_pd(t, best_t, _CMP_LT_OQ),
+                      _mm256_cmp_pd(index, last, _CMP_LT_OQ)));
+    best_t = _mm256_blendv_pd(best_t, t, closer);
+    best_index = _mm256_blendv_pd(best_index, index, closer);
+    index = _mm256_add_pd(index, _mm256_set1_pd(LANES));
+  }
+
+  alignas(32) double ts[LANES];
+  alignas(32) double indices[LANES];
+  _mm256_store_pd(ts, best_t);
+  _mm256_store_pd(indices, best_index);
+  bool did_hit = false;
+  for (size_t lane = 0; lane != LANES; ++lane) {
+    if (indices[lane] >= 0.0 && ts[lane] < closest) {
+      closest = ts[lane];
+      closest_index = static_cast<u32>(indices[lane]);
+      did_hit = true;
+    }
+  }
+  return did_hit;
+}
+
+template <>
+bool SphereSet<float>::intersect(const Ray<float> &ray, u32 first, u32 end,
+                                 float &closest,
+                                 u32 &closest_index) const noexcept {
+  const auto ox = _mm256_set1_ps(ray.origin.x);
+  const auto oy = _mm256_set1_ps(ray.origin.y);
+  const auto oz = _mm256_set1_ps(ray.origin.z);
+  const auto dx = _mm256_set1_ps(ray.direction.x);
+  const auto dy = _mm256_set1_ps(ray.direction.y);
+  const auto dz = _mm256_set1_ps(ray.direction.z);
+  const auto t_min = _mm256_set1_ps(MIN_HIT_DISTANCE<float>);
+  const auto zero = _mm256_setzero_ps();
+  // floats can't hold every index exactly, so these stay integers and share
+  // the float blends through casts.
+  const auto last = _mm256_set1_epi32(static_cast<int>(end));
+
+  auto best_t = _mm256_set1_ps(closest);
+  auto best_index = _mm256_set1_epi32(-1);
+  auto index = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(first)),
+                                _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  for (auto i = first; i < end; i += LANES) {
+    const auto cax = _mm256_sub_ps(ox, _mm256_loadu_ps(&center_x[i]));
+    const auto cay = _mm256_sub_ps(oy, _mm256_loadu_ps(&center_y[i]));
+    const auto caz = _mm256_sub_ps(oz, _mm256_loadu_ps(&center_z[i]));
+    const auto r = _mm256_loadu_ps(&radius[i]);
+    const auto h = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(cax, dx), _mm256_mul_ps(cay, dy)),
+        _mm256_mul_ps(caz, dz));
+    // distance from the center to the ray's line, see `solve`.
+    const auto fx = _mm256_sub_ps(cax, _mm256_mul_ps(h, dx));
+    const auto fy = _mm256_sub_ps(cay, _mm256_mul_ps(h, dy));
+    const auto fz = _mm256_sub_ps(caz, _mm256_mul_ps(h, dz));
+    const auto discriminant = _mm256_sub_ps(
+        _mm256_mul_ps(r, r),
+        _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(fx, fx), _mm256_mul_ps(fy, fy)),
+            _mm256_mul_ps(fz, fz)));
+    const auto solvable = _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ);
+    const auto dsqrt = _mm256_sqrt_ps(discriminant);
+    const auto t_near = _mm256_sub_ps(_mm256_sub_ps(zero, h), dsqrt);
+    const auto t_far = _mm256_sub_ps(dsqrt, h);
+    const auto t = _mm256_blendv_ps(t_far, t_near,
+                                    _mm256_cmp_ps(t_near, t_min, _CMP_GT_OQ));
+    const auto in_range = _mm256_castsi256_ps(_mm256_cmpgt_epi32(last, index));
+    const auto closer = _mm256_and_ps(
+        _mm256_and_ps(solvable, _mm256_cmp_ps(t, t_min, _CMP_GT_OQ)),
+        _mm256_and_ps(_mm256_cmp_ps(t, best_t, _CMP_LT_OQ), in_range));
+    best_t = _mm256_blendv_ps(best_t, t, closer);
+    best_index = _mm256_castps_si256(
+        _mm256_blendv_ps(_mm256_castsi256_ps(best_index),
+                         _mm256_castsi256_ps(index), closer));
+    index = _mm256_add_epi32(index, _mm256_set1_epi32(LANES));
+  }
+
+  alignas(32) float ts[LANES];
+  alignas(32) i32 indices[LANES];
+  _mm256_store_ps(ts, best_t);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(indices), best_index);
+  bool did_hit = false;
+  for (size_t lane = 0; lane != LANES; ++lane) {
+    if (indices[lane] >= 0 && ts[lane] < closest) {
+      closest = ts[lane];
+      closest_index = static_cast<u32>(indices[lane]);
+      did_hit = true;
+    }
+  }
+  return did_hit;
+}
+#else
+template <typename T>
+bool SphereSet<T>::intersect(const Ray<T> &ray, u32 first, u32 end,
+                             T &closest, u32 &closest_index) const noexcept {
+  bool did_hit = false;
+  for (auto i = first; i != end; ++i) {
+    const auto t =
+        solve(ray.origin - vec3_t<T>(center_x[i], center_y[i], center_z[i]),
+              ray.direction, radius[i]);
+    if (t > MIN_HIT_DISTANCE<T> && t < closest) {
+      closest = t;
+      closest_index = i;
+      did_hit = true;
+    }
+  }
+  return did_hit;
+}
+#endif
+
+template struct Sphere<float>;
+template struct Sphere<double>;
+template class SphereSet<float>;
+template class SphereSet<double>;
+
+} // namespace renderer::ray_tracer
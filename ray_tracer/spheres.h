@@ -0,0 +1,73 @@
+#pragma once
+#include "aligned_vector.h"
+#include "ray_tracer/ray.h"
+#include "types.h"
+#include <span>
+
+namespace renderer::ray_tracer {
+
+template <typename T> struct Sphere {
+  vec3_t<T> center;
+  T radius;
+
+  bool intersect(Ray<T> ray, Hit<T> &hit) const noexcept;
+};
+
+// Spheres stored as a structure of arrays so several of them can be tested
+// against a ray at once. Every array is padded with `LANES - 1` extra elements
+// so the SIMD kernel can always load a full register.
+template <typename T> class SphereSet {
+  size_t count = 0;
+  // filled by `add`. Unused while the set borrows its arrays.
+  utils::alloc::aligned_vector<T> own_center_x, own_center_y, own_center_z,
+      own_radius;
+  utils::alloc::aligned_vector<u32> own_material;
+
+  void view_own_arrays() noexcept;
+
+public:
+#if defined(__AVX512F__)
+  static constexpr size_t LANES = 64 / sizeof(T);
+#elif defined(__AVX2__)
+  static constexpr size_t LANES = 32 / sizeof(T);
+#else
+  static constexpr size_t LANES = 1;
+#endif
+  static constexpr u32 NO_SPHERE = ~u32(0);
+
+  // what everything reads: the set's own arrays, or the ones given to
+  // `borrow`. Padding included.
+  std::span<const T> center_x, center_y, center_z, radius;
+  std::span<const u32> material;
+
+  SphereSet() = default;
+  // the views would still point into the original's arrays.
+  SphereSet(const SphereSet &) = delete;
+  SphereSet &operator=(const SphereSet &) = delete;
+  SphereSet(SphereSet &&) noexcept = default;
+  SphereSet &operator=(SphereSet &&) noexcept = default;
+
+  size_t size() const noexcept { return count; }
+  bool empty() const noexcept { return count == 0; }
+  // makes room for `capacity` spheres, so adding them doesn't reallocate.
+  void reserve(size_t capacity);
+  void add(const Sphere<T> &sphere, u32 material_index);
+  Sphere<T> at(size_t index) const noexcept;
+  // rearranges the spheres so that the sphere at `order[i]` ends up at `i`.
+  void reorder(std::span<const u32> order);
+  // reads `count` spheres from arrays owned by someone else, such as a mapped
+  // scene cache, instead of copying them. Each array must have at least
+  // `LANES - 1` elements of padding and outlive the set. Drops the set's own
+  // spheres; it can't be added to or reordered afterwards.
+  void borrow(std::span<const T> center_x, std::span<const T> center_y,
+              std::span<const T> center_z, std::span<const T> radius,
+              std::span<const u32> material, size_t count);
+
+  // tests the spheres in [first, end) and updates `closest`/`closest_index` if
+  // any of them is hit nearer than `closest`. Only computes distances: the
+  // hit point and normal are left for the caller to compute for the winner.
+  bool intersect(const Ray<T> &ray, u32 first, u32 end, T &closest,
+                 u32 &closest_index) const noexcept;
+};
+
+} // namespace renderer::ray_tracer
@@ -0,0 +1,118 @@
+#pragma once
+#include "ray_tracer/bvh.h"
+#include "ray_tracer/ray.h"
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+namespace renderer::ray_tracer {
+
+// Affine transform of points and directions: a 3x3 linear part, stored by
+// rows, followed by a translation. The default is the identity.
+template <typename T> struct Transform {
+  using vec3 = vec3_t<T>;
+
+  vec3 rows[3] = {vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1)};
+  vec3 translation = vec3(0);
+
+  static Transform translate(const vec3 &offset) noexcept {
+    Transform result;
+    result.translation = offset;
+    return result;
+  }
+
+  static Transform scale(const vec3 &factors) noexcept {
+    Transform result;
+    for (int axis = 0; axis != 3; ++axis)
+      result.rows[axis][axis] = factors[axis];
+    return result;
+  }
+
+  // rotation by `degrees` about `axis`, counterclockwise looking down the
+  // axis towards the origin.
+  static Transform rotate(vec3 axis, T degrees) noexcept {
+    axis = glm::normalize(axis);
+    const auto angle = glm::radians(degrees);
+    const auto c = std::cos(angle), s = std::sin(angle), k = T(1) - c;
+    const auto x = axis.x, y = axis.y, z = axis.z;
+    Transform result;
+    result.rows[0] = vec3(c + x * x * k, x * y * k - z * s, x * z * k + y * s);
+    result.rows[1] = vec3(y * x * k + z * s, c + y * y * k, y * z * k - x * s);
+    result.rows[2] = vec3(z * x * k - y * s, z * y * k + x * s, c + z * z * k);
+    return result;
+  }
+
+  vec3 vector(const vec3 &v) const noexcept {
+    return vec3(glm::dot(rows[0], v), glm::dot(rows[1], v),
+                glm::dot(rows[2], v));
+  }
+  vec3 point(const vec3 &p) const noexcept { return vector(p) + translation; }
+  // the transpose of the linear part times `v`. Normals transform by the
+  // inverse transpose, so this is called on the inverse transform.
+  vec3 normal(const vec3 &n) const noexcept {
+    return rows[0] * n.x + rows[1] * n.y + rows[2] * n.z;
+  }
+
+  // `other` first, then this.
+  Transform operator*(const Transform &other) const noexcept {
+    Transform result;
+    for (int i = 0; i != 3; ++i) {
+      result.rows[i] = other.rows[0] * rows[i].x + other.rows[1] * rows[i].y +
+                       other.rows[2] * rows[i].z;
+    }
+    result.translation = point(other.translation);
+    return result;
+  }
+
+  T determinant() const noexcept {
+    return glm::dot(rows[0], glm::cross(rows[1], rows[2]));
+  }
+
+  // only meaningful if the determinant isn't 0.
+  Transform inverse() const noexcept {
+    // the columns of the inverse are the cross products of the rows.
+    const auto scale = T(1) / determinant();
+    const vec3 columns[3] = {glm::cross(rows[1], rows[2]),
+                             glm::cross(rows[2], rows[0]),
+                             glm::cross(rows[0], rows[1])};
+    Transform result;
+    for (int i = 0; i != 3; ++i) {
+      result.rows[i] =
+          vec3(columns[0][i], columns[1][i], columns[2][i]) * scale;
+    }
+    result.translation = -result.vector(translation);
+    return result;
+  }
+
+  // the box containing `box` once transformed (Arvo, "Transforming Axis-
+  // Aligned Bounding Boxes").
+  AABB<T> bounds(const AABB<T> &box) const noexcept {
+    AABB<T> result{translation, translation};
+    for (int i = 0; i != 3; ++i) {
+      for (int k = 0; k != 3; ++k) {
+        const auto a = rows[i][k] * box.min[k], b = rows[i][k] * box.max[k];
+        result.min[i] += std::min(a, b);
+        result.max[i] += std::max(a, b);
+      }
+    }
+    if constexpr (std::is_same_v<T, float>) {
+      // the sums can round inwards. Grow the box by a few ulps so it still
+      // contains the whole transformed box.
+      const auto slack = (glm::abs(result.min) + glm::abs(result.max)) *
+                         (8 * std::numeric_limits<T>::epsilon());
+      result.min -= slack;
+      result.max += slack;
+    }
+    return result;
+  }
+
+  template <typename U> Transform<U> cast() const noexcept {
+    Transform<U> result;
+    for (int i = 0; i != 3; ++i)
+      result.rows[i] = vec3_t<U>(rows[i]);
+    result.translation = vec3_t<U>(translation);
+    return result;
+  }
+};
+
+} // namespace renderer::ray_tracer
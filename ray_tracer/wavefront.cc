@@ -0,0 +1,199 @@
+#include "ray_tracer/wavefront.h"
+#include "ray_tracer/world.h"
+#include <utility>
+
+namespace renderer::ray_tracer {
+
+std::optional<IntegratorKind>
+parse_integrator_kind(std::string_view name) noexcept {
+  for (const auto kind : {IntegratorKind::Path, IntegratorKind::Packet,
+                          IntegratorKind::Wavefront}) {
+    if (to_string(kind) == name)
+      return kind;
+  }
+  return std::nullopt;
+}
+
+std::string_view to_string(IntegratorKind kind) noexcept {
+  switch (kind) {
+  case IntegratorKind::Path:
+    return "path";
+  case IntegratorKind::Packet:
+    return "packet";
+  case IntegratorKind::Wavefront:
+    return "wavefront";
+  }
+  return "unknown";
+}
+
+template <typename T> void Wavefront<T>::clear() noexcept {
+  origin_x.clear();
+  origin_y.clear();
+  origin_z.clear();
+  direction_x.clear();
+  direction_y.clear();
+  direction_z.clear();
+  throughput_r.clear();
+  throughput_g.clear();
+  throughput_b.clear();
+  slot.clear();
+  samplers.clear();
+  radiance.clear();
+}
+
+template <typename T>
+void Wavefront<T>::add(const Ray<T> &ray, const Sampler &sampler) {
+  origin_x.push_back(ray.origin.x);
+  origin_y.push_back(ray.origin.y);
+  origin_z.push_back(ray.origin.z);
+  direction_x.push_back(ray.direction.x);
+  direction_y.push_back(ray.direction.y);
+  direction_z.push_back(ray.direction.z);
+  throughput_r.push_back(T(1));
+  throughput_g.push_back(T(1));
+  throughput_b.push_back(T(1));
+  slot.push_back(static_cast<u32>(radiance.size()));
+  samplers.push_back(sampler);
+  radiance.push_back(vec3(0.0));
+}
+
+template <typename T> void Wavefront<T>::extend(const World<T> &world) {
+  const auto count = slot.size();
+  point_x.resize(count);
+  point_y.resize(count);
+  point_z.resize(count);
+  normal_x.resize(count);
+  normal_y.resize(count);
+  normal_z.resize(count);
+  material.resize(count);
+  alive.resize(count);
+  front_face.resize(count);
+
+  for (size_t p = 0; p != count; ++p) {
+    const Ray<T> ray{vec3(origin_x[p], origin_y[p], origin_z[p]),
+                  vec3(direction_x[p], direction_y[p], direction_z[p])};
+    Hit<T> hit;
+    if (!world.intersect(ray, hit)) {
+      // escaped: it picks up the background and is done.
+      const auto throughput =
+          vec3(throughput_r[p], throughput_g[p], throughput_b[p]);
+      radiance[slot[p]] = throughput * world.background(ray);
+      material[p] = NO_HIT;
+      alive[p] = false;
+      continue;
+    }
+    point_x[p] = hit.point.x;
+    point_y[p] = hit.point.y;
+    point_z[p] = hit.point.z;
+    normal_x[p] = hit.normal.x;
+    normal_y[p] = hit.normal.y;
+    normal_z[p] = hit.normal.z;
+    material[p] = hit.material;
+    front_face[p] = hit.front_face;
+    alive[p] = true;
+  }
+}
+
+template <typename T> void Wavefront<T>::sort() {
+  // counting sort on the material kind. Stable, so paths of the same kind are
+  // shaded in the order they were generated.
+  kind_offsets.assign(Materials<T>::KIND_COUNT + 1, 0);
+  for (size_t p = 0; p != material.size(); ++p) {
+    if (material[p] != NO_HIT)
+      ++kind_offsets[MaterialId{material[p]}.kind() + 1];
+  }
+  for (size_t k = 0; k != Materials<T>::KIND_COUNT; ++k)
+    kind_offsets[k + 1] += kind_offsets[k];
+
+  order.resize(kind_offsets.back());
+  auto next = kind_offsets;
+  for (size_t p = 0; p != material.size(); ++p) {
+    if (material[p] != NO_HIT)
+      order[next[MaterialId{material[p]}.kind()]++] = static_cast<u32>(p);
+  }
+}
+
+template <typename T>
+void Wavefront<T>::shade(const World<T> &world, u32 depth) {
+  // one loop per kind, so each runs a single inlined `scatter`.
+  const auto shade_kind = [&]<size_t K>() {
+    const auto &materials = world.materials.template of_kind<K>();
+    for (auto i = kind_offsets[K]; i != kind_offsets[K + 1]; ++i) {
+      const auto p = order[i];
+      const Hit<T> hit{vec3(point_x[p], point_y[p], point_z[p]),
+                       vec3(normal_x[p], normal_y[p], normal_z[p]), T(0),
+                       material[p], bool(front_face[p])};
+      const auto direction =
+          vec3(direction_x[p], direction_y[p], direction_z[p]);
+      samplers[p].start_bounce(depth);
+      const auto [attenuation, scattered] =
+          materials[MaterialId{material[p]}.index()].scatter(direction, hit,
+                                                              samplers[p]);
+      if (attenuation == vec3(0)) {
+        // absorbed: its radiance stays black.
+        alive[p] = false;
+        continue;
+      }
+      throughput_r[p] *= attenuation.r;
+      throughput_g[p] *= attenuation.g;
+      throughput_b[p] *= attenuation.b;
+      const auto origin = spawn_point(hit, scattered);
+      origin_x[p] = origin.x;
+      origin_y[p] = origin.y;
+      origin_z[p] = origin.z;
+      direction_x[p] = scattered.x;
+      direction_y[p] = scattered.y;
+      direction_z[p] = scattered.z;
+    }
+  };
+  [&]<size_t... K>(std::index_sequence<K...>) {
+    (shade_kind.template operator()<K>(), ...);
+  }(std::make_index_sequence<Materials<T>::KIND_COUNT>{});
+}
+
+template <typename T> void Wavefront<T>::compact() {
+  size_t live = 0;
+  for (size_t p = 0; p != slot.size(); ++p) {
+    if (!alive[p])
+      continue;
+    origin_x[live] = origin_x[p];
+    origin_y[live] = origin_y[p];
+    origin_z[live] = origin_z[p];
+    direction_x[live] = direction_x[p];
+    direction_y[live] = direction_y[p];
+    direction_z[live] = direction_z[p];
+    throughput_r[live] = throughput_r[p];
+    throughput_g[live] = throughput_g[p];
+    throughput_b[live] = throughput_b[p];
+    slot[live] = slot[p];
+    samplers[live] = samplers[p];
+    ++live;
+  }
+  origin_x.resize(live);
+  origin_y.resize(live);
+  origin_z.resize(live);
+  direction_x.resize(live);
+  direction_y.resize(live);
+  direction_z.resize(live);
+  throughput_r.resize(live);
+  throughput_g.resize(live);
+  throughput_b.resize(live);
+  slot.resize(live);
+  samplers.erase(samplers.begin() + live, samplers.end());
+}
+
+template <typename T>
+void Wavefront<T>::trace(const World<T> &world, u32 max_depth) {
+  for (u32 depth = 0; depth != max_depth && !slot.empty(); ++depth) {
+    extend(world);
+    sort();
+    shade(world, depth);
+    compact();
+  }
+  // whatever is left ran out of bounces and stays black.
+}
+
+template class Wavefront<float>;
+template class Wavefront<double>;
+
+} // namespace renderer::ray_tracer
@@ -0,0 +1,71 @@
+#pragma once
+#include "aligned_vector.h"
+#include "ray_tracer/ray.h"
+#include "ray_tracer/sampler.h"
+#include "types.h"
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace renderer::ray_tracer {
+
+template <typename T> struct World;
+
+// how camera samples are turned into colors: one path at a time
+// (`ray_color`), one path at a time after finding the first hits of 8x8
+// pixel blocks as `RayPacket`s, or a batch of paths a stage at a time
+// (`Wavefront`). All produce the same image.
+enum class IntegratorKind { Path, Packet, Wavefront };
+
+std::optional<IntegratorKind>
+parse_integrator_kind(std::string_view name) noexcept;
+std::string_view to_string(IntegratorKind kind) noexcept;
+
+// Traces a batch of paths breadth first. Every bounce runs as separate tight
+// loops over all the live paths: extend (intersect), sort by material kind,
+// shade, then compact away the paths that ended. Path state is kept as a
+// structure of arrays and the buffers are reused from one batch to the next.
+template <typename T> class Wavefront {
+  using vec3 = vec3_t<T>;
+
+  // live paths, compacted after every bounce.
+  utils::alloc::aligned_vector<T> origin_x, origin_y, origin_z;
+  utils::alloc::aligned_vector<T> direction_x, direction_y, direction_z;
+  utils::alloc::aligned_vector<T> throughput_r, throughput_g, throughput_b;
+  std::vector<u32> slot; // where the path's radiance goes
+  std::vector<Sampler> samplers;
+
+  // intersections of the current bounce, one per live path.
+  utils::alloc::aligned_vector<T> point_x, point_y, point_z;
+  utils::alloc::aligned_vector<T> normal_x, normal_y, normal_z;
+  std::vector<u32> material; // `NO_HIT` for paths that escaped
+  std::vector<u8> front_face;
+  std::vector<u8> alive;
+
+  // live paths that hit something, grouped by material kind.
+  std::vector<u32> order;
+  std::vector<u32> kind_offsets;
+
+  std::vector<vec3> radiance;
+
+  void extend(const World<T> &world);
+  void sort();
+  void shade(const World<T> &world, u32 depth);
+  void compact();
+
+public:
+  static constexpr u32 NO_HIT = ~u32(0);
+
+  size_t size() const noexcept { return radiance.size(); }
+  void clear() noexcept;
+  // generate: queues a camera ray. Its radiance ends up at index `size()`
+  // from before the call.
+  void add(const Ray<T> &ray, const Sampler &sampler);
+  // runs every queued path to completion. Paths still going after
+  // `max_depth` bounces are black.
+  void trace(const World<T> &world, u32 max_depth);
+  std::span<const vec3> results() const noexcept { return radiance; }
+};
+
+} // namespace renderer::ray_tracer
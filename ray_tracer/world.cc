@@ -0,0 +1,269 @@
+#include "ray_tracer/world.h"
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace renderer::ray_tracer {
+namespace {
+
+template <typename T>
+Hit<T> sphere_hit(const SphereSet<T> &spheres, const Ray<T> &ray, T t,
+                  u32 index) noexcept {
+  const auto point = ray.at(t);
+  const auto center =
+      vec3_t<T>(spheres.center_x[index], spheres.center_y[index],
+                spheres.center_z[index]);
+  return Hit<T>{point, glm::normalize(point - center), t,
+                spheres.material[index]};
+}
+
+// `local` is the ray in the instance's object space.
+template <typename T>
+Hit<T> instance_hit(const World<T> &world, const Instance<T> &instance,
+                    const Ray<T> &local, T t,
+                    const TriangleHit<T> &triangle) noexcept {
+  auto hit = world.meshes[instance.mesh].hit(local, t, triangle);
+  // facing and front_face carry over: transforming keeps the sign of the
+  // dot product of the ray with the normal.
+  hit.point = instance.object_to_world.point(hit.point);
+  hit.normal = glm::normalize(instance.world_to_object.normal(hit.normal));
+  if (instance.material != Instance<T>::MESH_MATERIAL)
+    hit.material = instance.material;
+  return hit;
+}
+
+// the ray in the instance's object space. Its direction isn't normalized, so
+// distances along it are still distances along `ray`.
+template <typename T>
+Ray<T> to_object(const Instance<T> &instance, const Ray<T> &ray) noexcept {
+  return Ray<T>{instance.world_to_object.point(ray.origin),
+                instance.world_to_object.vector(ray.direction)};
+}
+
+} // namespace
+
+template <typename T>
+vec3_t<T> World<T>::background(const Ray<T> &ray) const noexcept {
+  const auto t = T(0.5) * (ray.direction.y + T(1));
+  return (T(1) - t) * vec3_t<T>(1) + t * vec3_t<T>(0.5, 0.7, 1.0);
+}
+
+template <typename T>
+void World<T>::add(Sphere<T> sphere, MaterialId material) noexcept {
+  spheres.add(sphere, material.value);
+}
+
+template <typename T>
+u32 World<T>::add(TriangleMesh<T> mesh, MaterialId material) {
+  mesh.material = material.value;
+  meshes.push_back(std::move(mesh));
+  return static_cast<u32>(meshes.size() - 1);
+}
+
+template <typename T>
+void World<T>::add(u32 mesh, const Transform<T> &object_to_world,
+                   u32 material) {
+  instances.push_back(
+      Instance<T>{mesh, material, object_to_world, object_to_world.inverse()});
+}
+
+template <typename T> void World<T>::build_acceleration(size_t thread_count) {
+  std::vector<AABB<T>> bounds(spheres.size());
+  for (size_t i = 0; i != spheres.size(); ++i) {
+    const auto sphere = spheres.at(i);
+    auto extent = vec3_t<T>(sphere.radius);
+    if constexpr (std::is_same_v<T, float>) {
+      // center +- radius can round inwards. Grow the box by a few ulps so it
+      // still contains the whole sphere.
+      extent += (glm::abs(sphere.center) + extent) *
+                (4 * std::numeric_limits<T>::epsilon());
+    }
+    bounds[i] = AABB<T>{sphere.center - extent, sphere.center + extent};
+  }
+  bvh.build(bounds, thread_count);
+
+  // lay the spheres out in leaf order so leaves index them directly.
+  spheres.reorder(bvh.indices);
+
+  for (auto &mesh : meshes)
+    mesh.build_acceleration(thread_count);
+  build_instance_bvh(thread_count);
+}
+
+template <typename T>
+void World<T>::build_instance_bvh(size_t thread_count) {
+  std::vector<AABB<T>> bounds(instances.size());
+  for (size_t i = 0; i != instances.size(); ++i) {
+    const auto &instance = instances[i];
+    bounds[i] = instance.object_to_world.bounds(
+        meshes[instance.mesh].bvh.nodes[0].bounds);
+  }
+  instance_bvh.build(bounds, thread_count);
+
+  std::vector<Instance<T>> reordered(instances.size());
+  for (size_t i = 0; i != instances.size(); ++i)
+    reordered[i] = instances[instance_bvh.indices[i]];
+  instances = std::move(reordered);
+}
+
+template <typename T>
+bool World<T>::intersect(Ray<T> ray, Hit<T> &hit) const noexcept {
+  auto closest = std::numeric_limits<T>::infinity();
+  auto closest_index = SphereSet<T>::NO_SPHERE;
+  bvh.traverse(ray, closest, [&](u32 first, u32 count) {
+    spheres.intersect(ray, first, first + count, closest, closest_index);
+    return closest;
+  });
+  // instances only count if they're nearer than the closest sphere.
+  const Instance<T> *closest_instance = nullptr;
+  Ray<T> closest_local;
+  TriangleHit<T> triangle;
+  instance_bvh.traverse(ray, closest, [&](u32 first, u32 count) {
+    for (auto i = first; i != first + count; ++i) {
+      const auto &instance = instances[i];
+      const auto local = to_object(instance, ray);
+      if (meshes[instance.mesh].intersect(local, closest, triangle)) {
+        closest_instance = &instance;
+        closest_local = local;
+      }
+    }
+    return closest;
+  });
+  if (closest_instance) {
+    hit = instance_hit(*this, *closest_instance, closest_local, closest,
+                       triangle);
+    return true;
+  }
+  if (closest_index == SphereSet<T>::NO_SPHERE)
+    return false;
+
+  // only the winning sphere gets its hit point and normal computed.
+  hit = sphere_hit(spheres, ray, closest, closest_index);
+  return true;
+}
+
+template <typename T>
+typename RayPacket<T>::Mask
+World<T>::intersect(const RayPacket<T> &packet,
+                    std::span<Hit<T>> hits) const noexcept {
+  using Mask = typename RayPacket<T>::Mask;
+  constexpr auto MAX_SIZE = RayPacket<T>::MAX_SIZE;
+  const auto size = packet.size();
+  const auto for_each_ray = [](Mask rays, auto &&visit) {
+    for (; rays; rays &= rays - 1)
+      visit(static_cast<size_t>(std::countr_zero(rays)));
+  };
+
+  T closest[MAX_SIZE];
+  u32 closest_index[MAX_SIZE];
+  std::fill_n(closest, size, std::numeric_limits<T>::infinity());
+  std::fill_n(closest_index, size, SphereSet<T>::NO_SPHERE);
+  const std::span<const T> distances(closest, size);
+  bvh.traverse(packet, distances, [&](u32 first, u32 count, Mask active) {
+    for_each_ray(active, [&](size_t i) {
+      spheres.intersect(packet.rays[i], first, first + count, closest[i],
+                        closest_index[i]);
+    });
+  });
+
+  // every instance a leaf holds gets the leaf's active rays as a packet of
+  // their own, in its object space.
+  const Instance<T> *closest_instance[MAX_SIZE] = {};
+  Ray<T> closest_local[MAX_SIZE];
+  TriangleHit<T> triangle[MAX_SIZE];
+  instance_bvh.traverse(packet, distances, [&](u32 first, u32 count,
+                                               Mask active) {
+    Ray<T> local[MAX_SIZE];
+    size_t ray_of[MAX_SIZE];
+    T local_closest[MAX_SIZE];
+    TriangleHit<T> local_triangle[MAX_SIZE];
+    for (auto i = first; i != first + count; ++i) {
+      const auto &instance = instances[i];
+      size_t local_size = 0;
+      for_each_ray(active, [&](size_t ray) {
+        local[local_size] = to_object(instance, packet.rays[ray]);
+        local_closest[local_size] = closest[ray];
+        ray_of[local_size++] = ray;
+      });
+      const RayPacket<T> local_packet({local, local_size});
+      const auto found = meshes[instance.mesh].intersect(
+          local_packet, {local_closest, local_size},
+          {local_triangle, local_size});
+      for_each_ray(found, [&](size_t k) {
+        const auto ray = ray_of[k];
+        closest[ray] = local_closest[k];
+        closest_instance[ray] = &instance;
+        closest_local[ray] = local[k];
+        triangle[ray] = local_triangle[k];
+      });
+    }
+  });
+
+  Mask hit_rays = 0;
+  for (size_t i = 0; i != size; ++i) {
+    if (closest_instance[i]) {
+      hits[i] = instance_hit(*this, *closest_instance[i], closest_local[i],
+                             closest[i], triangle[i]);
+    } else if (closest_index[i] != SphereSet<T>::NO_SPHERE) {
+      hits[i] = sphere_hit(spheres, packet.rays[i], closest[i],
+                           closest_index[i]);
+    } else {
+      continue;
+    }
+    hit_rays |= Mask(1) << i;
+  }
+  return hit_rays;
+}
+
+template struct World<float>;
+template struct World<double>;
+
+template <typename T>
+vec3_t<T> ray_color(Ray<T> ray, const World<T> &world, u32 max_depth,
+                    Sampler &sampler) {
+  Hit<T> hit;
+  const bool found = max_depth && world.intersect(ray, hit);
+  return ray_color(ray, found, hit, world, max_depth, sampler);
+}
+
+template <typename T>
+vec3_t<T> ray_color(Ray<T> ray, bool found, Hit<T> hit, const World<T> &world,
+                    u32 max_depth, Sampler &sampler) {
+  // we multiply the colors as we go. The 'real' operation is in reverse order,
+  // but since it's multiplication the order of the operation doesn't matter, so
+  // we can reduce forward.
+  vec3_t<T> current(1);
+
+  for (u32 depth = 0; found; ++depth) {
+    sampler.start_bounce(depth);
+    auto [attenuation, direction] = world.materials.scatter(
+        MaterialId{hit.material}, ray.direction, hit, sampler);
+    ray.origin = spawn_point(hit, direction);
+    ray.direction = direction;
+    if (attenuation == vec3_t<T>(0)) {
+      return vec3_t<T>(0); // reducing isn't an option here. We can break and
+                           // return black.
+    }
+    current *= attenuation;
+    found = --max_depth && world.intersect(ray, hit);
+  }
+
+  if (max_depth == 0) {
+    return vec3_t<T>(0); // assume shadow
+  }
+
+  return current * world.background(ray);
+}
+
+template vec3_t<float> ray_color(Ray<float>, const World<float> &, u32,
+                                 Sampler &);
+template vec3_t<double> ray_color(Ray<double>, const World<double> &, u32,
+                                  Sampler &);
+template vec3_t<float> ray_color(Ray<float>, bool, Hit<float>,
+                                 const World<float> &, u32, Sampler &);
+template vec3_t<double> ray_color(Ray<double>, bool, Hit<double>,
+                                  const World<double> &, u32, Sampler &);
+} // namespace renderer::ray_tracer
@@ -0,0 +1,73 @@
+#pragma once
+#include "ray_tracer/bvh.h"
+#include "ray_tracer/materials.h"
+#include "ray_tracer/mesh.h"
+#include "ray_tracer/ray.h"
+#include "ray_tracer/sampler.h"
+#include "ray_tracer/spheres.h"
+#include "ray_tracer/transform.h"
+#include "types.h"
+#include <span>
+#include <vector>
+
+namespace renderer::ray_tracer {
+
+// A mesh placed in the world. Any number of instances can share a mesh and
+// its BVH.
+template <typename T> struct Instance {
+  // `material` value that keeps the mesh's own material.
+  static constexpr u32 MESH_MATERIAL = ~u32(0);
+
+  u32 mesh = 0;                 // index in `World::meshes`
+  u32 material = MESH_MATERIAL; // a `MaterialId` overriding the mesh's
+  Transform<T> object_to_world;
+  Transform<T> world_to_object;
+};
+
+// everything a ray can hit, in the precision it's traced in.
+template <typename T> struct World {
+  Materials<T> materials;
+  // reordered by `build_acceleration` to match the BVH leaves.
+  SphereSet<T> spheres;
+  BVH<T> bvh;
+  // the geometry instances refer to, each with a BVH of its own in object
+  // space. Not seen unless instanced.
+  std::vector<TriangleMesh<T>> meshes;
+  // reordered by `build_instance_bvh` to match the leaves of `instance_bvh`,
+  // the top level over the meshes' BVHs.
+  std::vector<Instance<T>> instances;
+  BVH<T> instance_bvh;
+
+  void add(Sphere<T> sphere, MaterialId material) noexcept;
+  // returns the index instances refer to the mesh by.
+  u32 add(TriangleMesh<T> mesh, MaterialId material);
+  // places mesh `mesh` with `object_to_world`, which must be invertible.
+  void add(u32 mesh, const Transform<T> &object_to_world,
+           u32 material = Instance<T>::MESH_MATERIAL);
+  bool empty() const noexcept { return spheres.empty() && instances.empty(); }
+  // must be called after the last `add` and before rendering.
+  void build_acceleration(size_t thread_count);
+  // rebuilds only the top level, after instances were added, removed or
+  // moved. The meshes' BVHs are kept.
+  void build_instance_bvh(size_t thread_count);
+  bool intersect(Ray<T> ray, Hit<T> &hit) const noexcept;
+  // the same for every ray of `packet`, with one `hits` entry per ray.
+  // Returns the rays that hit something; the other entries are left as they
+  // were.
+  typename RayPacket<T>::Mask intersect(const RayPacket<T> &packet,
+                                        std::span<Hit<T>> hits) const noexcept;
+  // color of the sky seen along a ray that hits nothing.
+  vec3_t<T> background(const Ray<T> &ray) const noexcept;
+};
+
+// color seen along `ray`, following it for at most `max_depth` bounces.
+template <typename T>
+vec3_t<T> ray_color(Ray<T> ray, const World<T> &world, u32 max_depth,
+                    Sampler &sampler);
+// the same, for a ray whose first intersection was already found: `hit` if
+// `found`, which it can't be if `max_depth` is 0.
+template <typename T>
+vec3_t<T> ray_color(Ray<T> ray, bool found, Hit<T> hit, const World<T> &world,
+                    u32 max_depth, Sampler &sampler);
+
+} // namespace renderer::ray_tracer
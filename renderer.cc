@@ -1,362 +1,430 @@
 #include "renderer.h"
 #include "log.h"
+#include <cstdlib>
 #include <cstring>
 #include <glm/glm.hpp>
-#include <random>
 #include <sstream>
 
 static utils::Log mainlog("renderer");
 
 namespace renderer {
 using vec3 = glm::highp_dvec3;
-using color = vec3;
-namespace utils::random {
-namespace {
-static std::uniform_int_distribution<u64> s_distribution;
-} // namespace
-static void init(std::mt19937 &engine) { engine.seed(std::random_device()()); }
 
-static u64 next_u64(std::mt19937 &engine) { return s_distribution(engine); }
-
-static double next_double(std::mt19937 &engine) {
-  return double(next_u64(engine)) / double(std::numeric_limits<u64>::max());
+namespace ray_tracer {
+template <typename T>
+static Ray<T> ray_at(const Camera &camera, const Camera::Basis &basis,
+                     double u, double v, double viewport_width,
+                     double viewport_height) noexcept {
+  // u,v in [0, 1] range. We translate them to [-0.5, 0.5] range, with the
+  // middle of the screen one unit in front of the camera.
+  const auto uv_place = basis.right * ((u - 0.5) * viewport_width) +
+                        basis.up * ((v - 0.5) * viewport_height) +
+                        basis.forward;
+  return Ray<T>{vec3_t<T>(camera.origin),
+                vec3_t<T>(glm::normalize(uv_place))};
 }
+} // namespace ray_tracer
+
+static constexpr size_t TILE_SIZE = 32;
 
-static vec3 next_vec(std::mt19937 &engine) {
-  return vec3{next_double(engine), next_double(engine), next_double(engine)};
+static u8 make_channel_integer(double ch) {
+  return static_cast<u8>(glm::clamp(ch * 255.999, 0.0, 255.999));
 }
 
-} // namespace utils::random
+static u32 to_abgr(vec3 color) {
+  const auto r = static_cast<u32>(make_channel_integer(color.r));
+  const auto g = static_cast<u32>(make_channel_integer(color.g));
+  const auto b = static_cast<u32>(make_channel_integer(color.b));
 
-namespace ray_tracer {
-vec3 Ray::at(double t) const noexcept { return origin + t * direction; }
+  return 0xff << 24 | u32(b) << 16 | u32(g) << 8 | u32(r);
+}
+static double luminance(vec3 color) {
+  return glm::dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
 
-struct material_traits {
-  virtual ~material_traits() {}
-  virtual std::pair<vec3, vec3> scatter(vec3 ray_direction, Hit hit,
-                                        std::mt19937 &rand) const noexcept = 0;
-};
-struct Hit {
-  vec3 point = vec3(0.0);
-  vec3 normal = vec3(0.0);
-  double selected_t = 0;
-  size_t mat_index = 0;
-  bool front_face = true;
-
-  void make_facing_outwards(const Ray &ray) {
-    if (glm::dot(ray.direction, normal) < 0.0f) {
-      front_face = false;
-      normal *= -1.0f;
-    }
+// claims `count` samples from the ones given up by converged tiles.
+static bool take_spare_samples(std::atomic<size_t> &spare, size_t count) {
+  auto available = spare.load(std::memory_order_relaxed);
+  while (available >= count) {
+    if (spare.compare_exchange_weak(available, available - count,
+                                    std::memory_order_relaxed))
+      return true;
   }
+  return false;
+}
+
+struct RenderResult {
+  size_t worker_id;
+  WorkerStats stats;
 };
 
-bool Sphere::intersect(Ray ray, Hit &hit) const noexcept {
-  const Sphere &sphere = *this;
-  const auto ca = ray.origin - sphere.center;
-  const auto c = glm::dot(ca, ca) - sphere.radius * sphere.radius;
-  const auto h = glm::dot(ca, ray.direction);
-  const auto discriminant = h * h - c;
-  // cannot solve the square root
-  if (discriminant < 0.0)
-    return false;
+// paths are cut off (and left black) after this many bounces.
+static constexpr u32 MAX_DEPTH = 50;
+// upper bound on the paths a worker traces at once with the wavefront
+// integrator, which keeps its buffers at a few megabytes.
+static constexpr size_t WAVEFRONT_BATCH = 1 << 14;
 
-  // compute the two solutions
-  const auto dsqrt = std::sqrt(discriminant);
-  const auto t1 = -h + dsqrt;
-  const auto t2 = -h - dsqrt;
-  // return the lowest positive value
-  auto t = t1;
-  if (t < 0.0 || std::abs(t1) > std::abs(t2)) {
-    if (t2 < 0.0)
-      return false;
-    t = t2;
-  }
-  // NOTE: the ray doesn't hit if it's tangent.
-  if (t <= 0.0001)
-    return false;
+WorkerThread::WorkerThread(size_t id,
+                           threading::mpsc_queue<RenderResult> &results,
+                           std::atomic<bool> const &cancel,
+                           std::optional<u32> cpu)
+    : results(results),
+      logger((std::ostringstream() << "renderer::worker{" << id << '}').str()),
 
-  const auto point = ray.at(t);
-  const auto normal = glm::normalize(point - sphere.center);
-  hit = Hit{point, normal, t};
-  return true;
-}
+      cancel(cancel), worker_id(id), cpu(cpu),
+      handle(&WorkerThread::run, this) {}
 
-static vec3 random_in_unit_sphere(std::mt19937 &engine) {
+void WorkerThread::run() {
+  if (cpu) {
+    if (threading::pin_current_thread(*cpu))
+      logger.debug() << "Pinned to CPU " << *cpu << '\n';
+    else
+      logger.warn() << "Could not pin to CPU " << *cpu << '\n';
+  }
+  std::unique_lock lock(mutex);
   while (true) {
-    const auto p = utils::random::next_vec(engine);
-    if (glm::dot(p, p) >= 1.0)
-      continue;
-    return p;
+    state_changed.wait(lock, [this] { return pending || quitting; });
+    if (quitting)
+      return;
+    const RenderRequest request = *pending;
+    pending.reset();
+    lock.unlock();
+
+    render(request);
+
+    lock.lock();
+    busy = false;
+    state_changed.notify_all();
   }
 }
-static vec3 random_in_hemisphere(vec3 normal, std::mt19937 &engine) {
-  const auto p = random_in_unit_sphere(engine);
-  return glm::dot(normal, p) < 0.0 ? -p : p;
-}
-static vec3 as_background(Ray ray) {
-  const auto t = 0.5f * (ray.direction.y + 1.0f);
-  return (1.0f - t) * vec3(1.0f, 1.0f, 1.0f) + t * vec3(0.5, 0.7, 1.0);
-}
-
-size_t World::create_material(std::unique_ptr<material_traits> mat) noexcept {
-  const auto index = materials.size();
-  materials.push_back(std::move(mat));
-  return index;
-}
-
-const material_traits &World::material_at(size_t index) const noexcept {
-  return *materials[index].get();
-}
-
-void World::add(Sphere sphere, size_t material) noexcept {
-  spheres.emplace_back(std::move(sphere), material);
-}
 
-std::pair<color, vec3> World::scatter(vec3 ray_direction, Hit &record,
-                                      std::mt19937 &rand) const noexcept {
-  return material_at(record.mat_index)
-      .scatter(ray_direction, std::move(record), rand);
-}
-
-bool World::intersect(Ray ray, Hit &hit) const noexcept {
-  hit.selected_t = std::numeric_limits<double>::infinity();
-  Hit temp_hit;
-  bool did_hit = false;
-  for (const auto &[sphere, mat_index] : spheres) {
-    if (sphere.intersect(ray, temp_hit)) {
-      did_hit = true;
-      temp_hit.mat_index = mat_index;
-      if (temp_hit.selected_t < hit.selected_t)
-        hit = temp_hit;
+template <typename T>
+void WorkerThread::sample_tile(const RenderRequest &request, const Tile &tile,
+                               size_t samples,
+                               const ray_tracer::World<T> &world,
+                               ray_tracer::Wavefront<T> &wavefront,
+                               vec3 *color, double *squares) {
+  const auto &settings = request.settings;
+  const auto &camera = request.scene.camera;
+  const auto basis = camera.basis();
+  const auto camera_sample = [&](u32 i, u32 y, ray_tracer::Sampler &sampler) {
+    const auto j = request.height - y;
+    const auto [du, dv] = sampler.next_2d();
+    const auto u = (i + du) / (request.width - 1);
+    const auto v = (j + dv) / (request.height - 1);
+    return ray_tracer::ray_at<T>(camera, basis, u, v,
+                                 request.virtual_viewport_width,
+                                 request.virtual_viewport_height);
+  };
+  const auto sampler_for = [&](size_t index, size_t sample) {
+    return ray_tracer::Sampler(settings.sampler, settings.seed, index,
+                               static_cast<u32>(tile.samples + sample),
+                               static_cast<u32>(settings.samples_per_pixel));
+  };
+  const auto add_sample = [&](size_t k, vec3 sample_color) {
+    color[k] += sample_color;
+    squares[k] += luminance(sample_color) * luminance(sample_color);
+  };
+
+  if (settings.integrator == ray_tracer::IntegratorKind::Path) {
+    size_t k = 0;
+    for (auto y = tile.y; y != tile.y + tile.height; ++y) {
+      for (auto i = tile.x; i != tile.x + tile.width; ++i, ++k) {
+        const auto index = y * request.width + i;
+        for (size_t sample = 0; sample != samples; ++sample) {
+          auto sampler = sampler_for(index, sample);
+          const auto ray = camera_sample(i, y, sampler);
+          add_sample(k, vec3(ray_tracer::ray_color(ray, world, MAX_DEPTH,
+                                                   sampler)));
+        }
+      }
     }
+    return;
   }
 
-  return did_hit;
-}
-
-static vec3 ray_color(Ray ray, const World &world, uint32_t max_depth,
-                      std::mt19937 &rand) {
-  Hit hit;
-
-  // we multiply the colors as we go. The 'real' operation is in reverse order,
-  // but since it's multiplication the order of the operation doesn't matter, so
-  // we can reduce forward.
-  color current(1.0);
-
-  for (; max_depth && world.intersect(ray, hit); --max_depth) {
-    ray.origin = hit.point;
-    auto [attenuation, direction] =
-        world.scatter(std::move(ray.direction), hit, rand);
-    ray.direction = direction;
-    if (attenuation == vec3(0.0)) {
-      return vec3(0.0); // reducing isn't an option here. We can break and
-                        // return black.
+  if (settings.integrator == ray_tracer::IntegratorKind::Packet) {
+    // a sample of every pixel of an 8x8 block at a time, so each pixel still
+    // sums its samples in order and the image matches the path integrator.
+    constexpr u32 BLOCK = 8;
+    static_assert(BLOCK * BLOCK <= ray_tracer::RayPacket<T>::MAX_SIZE);
+    ray_tracer::Ray<T> rays[BLOCK * BLOCK];
+    ray_tracer::Hit<T> hits[BLOCK * BLOCK];
+    size_t pixel_of[BLOCK * BLOCK];
+    std::vector<ray_tracer::Sampler> samplers;
+    samplers.reserve(BLOCK * BLOCK);
+    for (u32 block_y = 0; block_y < tile.height; block_y += BLOCK) {
+      for (u32 block_x = 0; block_x < tile.width; block_x += BLOCK) {
+        const auto height = std::min(BLOCK, tile.height - block_y);
+        const auto width = std::min(BLOCK, tile.width - block_x);
+        for (size_t sample = 0; sample != samples; ++sample) {
+          samplers.clear();
+          for (auto y = tile.y + block_y; y != tile.y + block_y + height;
+               ++y) {
+            for (auto i = tile.x + block_x; i != tile.x + block_x + width;
+                 ++i) {
+              const auto n = samplers.size();
+              samplers.push_back(sampler_for(y * request.width + i, sample));
+              rays[n] = camera_sample(i, y, samplers.back());
+              pixel_of[n] = (y - tile.y) * tile.width + (i - tile.x);
+            }
+          }
+          const ray_tracer::RayPacket<T> packet({rays, samplers.size()});
+          const auto found = world.intersect(packet, hits);
+          for (size_t n = 0; n != samplers.size(); ++n) {
+            add_sample(pixel_of[n],
+                       vec3(ray_tracer::ray_color(
+                           rays[n], ((found >> n) & 1) != 0, hits[n], world,
+                           MAX_DEPTH, samplers[n])));
+          }
+        }
+      }
     }
-    current *= attenuation;
+    return;
   }
 
-  if (max_depth == 0) {
-    return vec3(0.0); // assume shadow
+  // as many samples of every pixel as fit in a batch. Results come back in
+  // the order the paths were added, so each pixel still sums its samples in
+  // order and the image matches the path integrator.
+  const auto pixels = static_cast<size_t>(tile.width) * tile.height;
+  const auto chunk = std::clamp<size_t>(WAVEFRONT_BATCH / pixels, 1,
+                                        std::max<size_t>(samples, 1));
+  for (size_t first = 0; first < samples; first += chunk) {
+    const auto last = std::min(first + chunk, samples);
+    wavefront.clear();
+    for (auto y = tile.y; y != tile.y + tile.height; ++y) {
+      for (auto i = tile.x; i != tile.x + tile.width; ++i) {
+        const auto index = y * request.width + i;
+        for (auto sample = first; sample != last; ++sample) {
+          auto sampler = sampler_for(index, sample);
+          wavefront.add(camera_sample(i, y, sampler), sampler);
+        }
+      }
+    }
+    wavefront.trace(world, MAX_DEPTH);
+    const auto radiance = wavefront.results();
+    for (size_t k = 0, n = 0; k != pixels; ++k) {
+      for (auto sample = first; sample != last; ++sample)
+        add_sample(k, vec3(radiance[n++]));
+    }
   }
-
-  return current * as_background(ray);
-}
-static Ray ray_at(double u, double v, double viewport_width,
-                  double viewport_height) noexcept {
-  // middle of the screen is 0,0.
-  const auto uv_origin = vec3(0.0, 0.0, 0.0);
-  // u,v in [0, 1] range. We translate them to [-0.5, 0.5] range
-  const auto uv_place =
-      vec3((u - 0.5) * viewport_width, (v - 0.5) * viewport_height, -1.0);
-  return Ray{uv_origin, glm::normalize(uv_place - uv_origin)};
 }
-struct lambertian : public material_traits {
-  color albedo;
 
-  constexpr lambertian(color albedo) : albedo(std::move(albedo)) {}
-
-  virtual std::pair<color, vec3>
-  scatter(vec3 ray_direction, Hit record,
-          std::mt19937 &rand) const noexcept override {
-    auto direction = glm::normalize(record.normal +
-                                    random_in_hemisphere(record.normal, rand));
-    return {albedo, direction};
-  }
-};
+void WorkerThread::render(const RenderRequest &request) {
+  std::fill(request.data + request.clear_begin,
+            request.data + request.clear_end, 0u);
+  std::fill(request.accumulation + request.clear_begin,
+            request.accumulation + request.clear_end, glm::vec3(0.0f));
+  std::fill(request.luminance_squares + request.clear_begin,
+            request.luminance_squares + request.clear_end, 0.0f);
+  request.cleared.arrive_and_wait();
+
+  WorkerStats stats;
+  Timer tile_timer;
+  // sums of a pass' samples for every pixel of the tile, in row order.
+  std::vector<vec3> pass_color(TILE_SIZE * TILE_SIZE);
+  std::vector<double> pass_squares(TILE_SIZE * TILE_SIZE);
+  while (true) {
+    auto tile = request.tiles.pop(worker_id);
+    if (!tile) {
+      tile = request.tiles.steal(worker_id);
+      if (!tile) {
+        if (request.tiles_left.load(std::memory_order_acquire) == 0)
+          break;
+        // the tiles left are being rendered and may come back for more
+        // passes.
+        if (cancel.load(std::memory_order_relaxed)) {
+          logger.debug() << "Cancelling job!\n";
+          return;
+        }
+        std::this_thread::yield();
+        continue;
+      }
+      ++stats.stolen_tiles;
+    }
 
-struct metal : public material_traits {
-  color albedo;
-  double fuzz;
-
-  constexpr metal(color albedo, double fuzz)
-      : albedo(std::move(albedo)), fuzz(fuzz < 1 ? fuzz : 1) {}
-
-  virtual std::pair<color, vec3>
-  scatter(vec3 ray_direction, Hit record,
-          std::mt19937 &rand) const noexcept override {
-    const auto reflected =
-        reflect(ray_direction, record.normal) +
-        fuzz * glm::normalize(random_in_hemisphere(record.normal, rand));
-    // only reflect if the resulting reflected ray is above the normal.
-    const auto attenuation =
-        glm::dot(reflected, record.normal) > 0 ? albedo : vec3(0.0);
-    return {attenuation, reflected};
-  }
-};
-static vec3 refract(const vec3 v, const vec3 n, glm::f64 refraction_ratio) {
-  const auto nndotv = n * glm::dot(-v, n);
-  const auto s = nndotv + v;
-  const auto v_perp = s / refraction_ratio;
-  const auto v_parallel = -nndotv;
-  return v_perp + v_parallel;
-}
-struct dielectric : public material_traits {
-  double refraction_index;
-
-  constexpr dielectric(double refraction_index)
-      : refraction_index(refraction_index) {}
-
-  virtual std::pair<color, vec3>
-  scatter(vec3 ray_direction, Hit record,
-          std::mt19937 &rand) const noexcept override {
-    const auto refraction_ratio =
-        record.front_face ? 1.0 / refraction_index : refraction_index;
-    const auto cos_theta =
-        glm::min(glm::dot(-ray_direction, record.normal), 1.0);
-    const auto sin_theta = glm::sqrt(glm::abs(1.0 - cos_theta * cos_theta));
-    const auto cannot_refract = sin_theta * refraction_ratio > 1.0;
-    const auto reflectance =
-        dielectric::reflectance(cos_theta, refraction_index);
-    if (cannot_refract || reflectance > utils::random::next_double(rand)) {
-      const auto reflected = reflect(ray_direction, record.normal);
-      return {vec3(1.0), reflected};
-    } else {
-      const auto refracted =
-          refract(ray_direction, record.normal, refraction_ratio);
-      return {vec3(1.0), refracted};
+    tile_timer.reset();
+    const auto &settings = request.settings;
+    const auto samples = std::min<size_t>(settings.samples_per_pass,
+                                          tile->allowed - tile->samples);
+    const auto total_samples = static_cast<double>(tile->samples + samples);
+    const bool adaptive = settings.noise_threshold > 0.0 &&
+                          total_samples >= settings.min_samples_per_pixel &&
+                          total_samples > 1.0;
+    const auto pixels = static_cast<size_t>(tile->width) * tile->height;
+    std::fill_n(pass_color.begin(), pixels, vec3(0.0));
+    std::fill_n(pass_squares.begin(), pixels, 0.0);
+    if (settings.precision == Precision::Float)
+      sample_tile(request, *tile, samples, request.scene.world_float,
+                  wavefront_float, pass_color.data(), pass_squares.data());
+    else
+      sample_tile(request, *tile, samples, request.scene.world, wavefront,
+                  pass_color.data(), pass_squares.data());
+
+    // sum of the squared relative standard errors of the tile's pixels.
+    double tile_error = 0.0;
+    size_t k = 0;
+    for (auto y = tile->y; y != tile->y + tile->height; ++y) {
+      for (auto i = tile->x; i != tile->x + tile->width; ++i, ++k) {
+        const auto index = y * request.width + i;
+        const auto color = pass_color[k];
+        const auto squares = pass_squares[k];
+        auto &sum = request.accumulation[index];
+        sum += glm::vec3(color);
+        auto &luminance_squares = request.luminance_squares[index];
+        luminance_squares += static_cast<float>(squares);
+        const auto mean = vec3(sum) / total_samples;
+        request.data[index] = to_abgr(mean);
+
+        if (adaptive) {
+          const auto mean_luminance = luminance(mean);
+          const auto variance =
+              std::max(luminance_squares / total_samples -
+                           mean_luminance * mean_luminance,
+                       0.0) *
+              total_samples / (total_samples - 1.0);
+          // dark pixels are judged on an absolute scale, or they'd never
+          // converge.
+          const auto error = std::sqrt(variance / total_samples) /
+                             std::max(mean_luminance, 0.05);
+          tile_error += error * error;
+        }
+      }
+    }
+    stats.busy_ms += tile_timer.millis();
+    stats.samples += samples * tile->width * tile->height;
+    ++stats.tiles;
+    request.dirty_tiles[tile->y / TILE_SIZE * request.tiles_x +
+                        tile->x / TILE_SIZE]
+        .store(1, std::memory_order_release);
+
+    tile->samples += static_cast<u32>(samples);
+    // judge the tile by its RMS error. A single firefly shouldn't keep the
+    // whole tile going.
+    if (adaptive &&
+        std::sqrt(tile_error / pixels) <= settings.noise_threshold) {
+      // converged: give away what's left of the tile's budget.
+      if (tile->samples < settings.samples_per_pixel)
+        request.spare_samples.fetch_add(
+            (settings.samples_per_pixel - tile->samples) * pixels,
+            std::memory_order_relaxed);
+      request.tiles_left.fetch_sub(1, std::memory_order_release);
+      continue;
+    }
+    if (tile->samples == tile->allowed && settings.noise_threshold > 0.0 &&
+        tile->samples < settings.max_samples_per_pixel) {
+      // still noisy after its budget. Try to get another pass out of the
+      // samples other tiles didn't need.
+      const auto extra =
+          std::min(settings.samples_per_pass,
+                   settings.max_samples_per_pixel - tile->samples);
+      if (take_spare_samples(request.spare_samples, extra * pixels))
+        tile->allowed += static_cast<u32>(extra);
+    }
+    // queue it behind every other tile so the whole frame refines evenly.
+    if (tile->samples < tile->allowed)
+      request.tiles.push(worker_id, *tile);
+    else
+      request.tiles_left.fetch_sub(1, std::memory_order_release);
+
+    if (cancel.load(std::memory_order_relaxed)) {
+      logger.debug() << "Cancelling job!\n";
+      return;
     }
   }
+  // we've finished. Send a signal and go back to sleep.
+  results.blocking_emplace(RenderResult{worker_id, stats});
+  logger.debug() << "Emplaced result. Waiting for more work...\n";
+}
 
-private:
-  static glm::f64 reflectance(glm::f64 cosine, glm::f64 refraction_index) {
-    // Use Schlick's approximation for reflectance.
-    auto r0 = (1.0 - refraction_index) / (1.0 + refraction_index);
-    r0 = r0 * r0;
-    return r0 + (1.0 - r0) * glm::pow(1.0 - cosine, 5);
+void WorkerThread::launch(RenderRequest request) {
+  logger.info() << "Received render request!\n";
+  {
+    std::lock_guard lock(mutex);
+    pending.emplace(request);
+    busy = true;
   }
-};
-} // namespace ray_tracer
-
-static constexpr size_t NUM_THREADS = 12;
-static constexpr size_t BLOCK_SIZE = 16;
-static constexpr size_t SAMPLES_PER_PIXEL = 100;
-
-static u8 make_channel_integer(double ch) {
-  return static_cast<u8>(glm::clamp(ch * 255.999, 0.0, 255.999));
+  state_changed.notify_all();
 }
 
-static u32 to_abgr(vec3 color) {
-  const auto r = static_cast<u32>(make_channel_integer(color.r));
-  const auto g = static_cast<u32>(make_channel_integer(color.g));
-  const auto b = static_cast<u32>(make_channel_integer(color.b));
-
-  return 0xff << 24 | u32(b) << 16 | u32(g) << 8 | u32(r);
+void WorkerThread::wait_idle() {
+  std::unique_lock lock(mutex);
+  state_changed.wait(lock, [this] { return !busy; });
 }
-struct RenderResult {
-  size_t worker_id;
-};
 
-static vec3 color_at(double u, double v, double viewport_width,
-                     double viewport_height, const ray_tracer::World &world,
-                     std::mt19937 &random_engine) {
-  // this should do the ray tracing lol
-  const auto ray = ray_tracer::ray_at(u, v, viewport_width, viewport_height);
-  return ray_tracer::ray_color(ray, world, 50, random_engine);
+WorkerThread::~WorkerThread() {
+  {
+    std::lock_guard lock(mutex);
+    quitting = true;
+  }
+  state_changed.notify_all();
+  handle.join();
 }
 
-WorkerThread::WorkerThread(size_t id,
-                           threading::mpsc_queue<RenderResult> &results,
-                           bool const &cancel)
-    : results(results),
-      logger((std::ostringstream() << "renderer::worker{" << id << '}').str()),
+size_t default_thread_count() {
+  if (const char *env = std::getenv("RAYTRACER_THREADS")) {
+    char *end;
+    const auto count = std::strtoul(env, &end, 10);
+    if (*end == '\0' && count > 0)
+      return count;
+    mainlog.warn() << "Ignoring invalid RAYTRACER_THREADS=" << env << '\n';
+  }
+  return threading::CpuTopology::detect().cpu_count();
+}
 
-      cancel(cancel), worker_id(id) {}
+// renders the built-in scene until `load_scene` replaces it.
+MainRenderThread::MainRenderThread(size_t requested_threads)
+    : thread_count(requested_threads ? requested_threads
+                                     : default_thread_count()),
+      topology(threading::CpuTopology::detect()), results(thread_count),
+      tiles(thread_count), cleared(thread_count), worker_stats(thread_count) {
+  // pinning only helps when every worker gets a CPU of its own.
+  const bool pin = thread_count <= topology.cpu_count();
+  mainlog.info() << "Starting " << thread_count << " workers over "
+                 << topology.nodes.size() << " NUMA node(s)"
+                 << (pin ? ", pinned" : "") << '\n';
 
-void WorkerThread::launch(RenderRequest request) {
-  logger.info() << "Received render request!\n";
-  auto &sender = results;
-  auto const &signal = this->cancel;
-  handle = std::thread([request, id = worker_id, &signal, &sender,
-                        &workerlog = logger]() {
-    std::mt19937 rand;
-    utils::random::init(rand);
-    for (auto *block_start = request.start; block_start < request.end;
-         block_start += BLOCK_SIZE * NUM_THREADS) {
-      const auto block_end = std::min(&block_start[BLOCK_SIZE], request.end);
-      for (auto *current = block_start; current != block_end; ++current) {
-        const auto index = current - request.start + request.starting_index;
-        const auto i = index % request.width;
-        const auto j = request.height - (index / request.width);
-        vec3 color(0.0);
-        for (size_t sample = 0; sample != SAMPLES_PER_PIXEL; ++sample) {
-          const auto u =
-              (i + utils::random::next_double(rand)) / (request.width - 1);
-          const auto v =
-              (j + utils::random::next_double(rand)) / (request.height - 1);
-          color += color_at(u, v, request.virtual_viewport_width,
-                            request.virtual_viewport_height, request.world_view,
-                            rand);
-        }
-        *current = to_abgr(color / static_cast<double>(SAMPLES_PER_PIXEL));
-      }
-      if (signal) {
-        workerlog.debug() << "Cancelling job!\n";
-        return;
-      }
-    }
-    // we've finished. Send a signal and spin until we're given a quit
-    // message
-    sender.blocking_emplace(RenderResult{id});
-    workerlog.debug() << "Emplaced result. Quitting...\n";
-  });
+  // initialize workers in idle state
+  threads = (WorkerThread *)operator new[](sizeof(WorkerThread) * thread_count);
+  for (size_t i = 0; i != thread_count; ++i) {
+    new (&threads[i])
+        WorkerThread(i, results, this->cancel_signal,
+                     pin ? std::optional(topology.cpu_for(i)) : std::nullopt);
+  }
+  ray_tracer::SceneLoader loader(scene);
+  ray_tracer::builtin_scene(loader);
+  scene.build_acceleration(thread_count);
+  virtual_viewport_width = scene.camera.viewport_width;
 }
 
-void WorkerThread::drop_thread() {
-  if (handle) {
-    handle->join();
-    handle.reset();
-  }
+bool MainRenderThread::load_scene(std::string_view path) {
+  stop_pipeline();
+  if (!ray_tracer::load_scene(path, scene, thread_count))
+    return false;
+  virtual_viewport_width = scene.camera.viewport_width;
+  return true;
 }
-WorkerThread::~WorkerThread() { drop_thread(); }
 
-MainRenderThread::MainRenderThread() : results(NUM_THREADS) {
-  // initialize workers in idle state
-  threads = (WorkerThread *)operator new[](sizeof(WorkerThread) * NUM_THREADS);
-  for (size_t i = 0; i != NUM_THREADS; ++i) {
-    new (&threads[i]) WorkerThread(i, results, this->cancel_signal);
-  }
-  virtual_viewport_width = 2.0;
-
-  // world
-  const auto sphere_mat = world.create_material(
-      std::make_unique<ray_tracer::lambertian>(color(0.1, 0.3, 0.5)));
-  const auto floor = world.create_material(
-      std::make_unique<ray_tracer::lambertian>(color(0.5)));
-  world.add(ray_tracer::Sphere{vec3(0.0, 0.0, -1.0), 0.5}, sphere_mat);
-  world.add(ray_tracer::Sphere{vec3(0.0, -100.5, -1.0), 100.0}, floor);
+void MainRenderThread::set_scene(ray_tracer::Scene new_scene) {
+  stop_pipeline();
+  scene = std::move(new_scene);
+  virtual_viewport_width = scene.camera.viewport_width;
 }
 
 void MainRenderThread::stop_pipeline() {
-  mainlog.debug() << "Stopping pipeline, waiting for threads to join...\n";
+  mainlog.debug() << "Stopping pipeline, waiting for workers to go idle...\n";
   cancel_signal = true;
-  for (size_t i = 0; i < NUM_THREADS; ++i) {
-    threads[i].drop_thread();
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads[i].wait_idle();
   }
   cancel_signal = false;
+  // workers that finished right before the cancel still posted their result.
+  while (results.try_pop())
+    ;
+  jobs_left = 0;
 }
 
-void MainRenderThread::on_resize(size_t width, size_t height) {
+void MainRenderThread::on_resize(size_t width, size_t height,
+                                 u32 *new_target) {
   virtual_viewport_height = virtual_viewport_width * height / width;
   mainlog.debug() << "Resized virtual viewport to " << virtual_viewport_width
                   << 'x' << virtual_viewport_height << '\n';
@@ -364,33 +432,82 @@ void MainRenderThread::on_resize(size_t width, size_t height) {
   // cancel the pipeline because I'm going to allocate the data array
   stop_pipeline();
 
-  // do the resizing
-  data.resize(width * height);
-
-  // fill with zero
-  std::memset(data.get(), 0, width * height * sizeof(u32));
+  // do the resizing. The workers clear it.
+  frame_width = width;
+  frame_height = height;
+  if (new_target) {
+    data = nullptr;
+    target = new_target;
+  } else {
+    data.resize(width * height);
+    target = data.get();
+  }
+  accumulation.resize(width * height);
+  luminance_squares.resize(width * height);
+  spare_samples = 0;
+
+  // split the frame in tiles. Each worker starts with a contiguous band of
+  // them and steals from the others once it runs out. Neighbouring workers
+  // share a NUMA node, and stealing tries the neighbours first.
+  tiles.clear();
+  const auto tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+  const auto tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+  const auto tile_count = tiles_x * tiles_y;
+  this->tiles_x = tiles_x;
+  // the whole buffer is cleared.
+  dirty_tiles = std::vector<std::atomic<u8>>(tile_count);
+  for (auto &dirty : dirty_tiles)
+    dirty.store(1, std::memory_order_relaxed);
+  for (size_t t = 0; t != tile_count; ++t) {
+    const auto x = (t % tiles_x) * TILE_SIZE;
+    const auto y = (t / tiles_x) * TILE_SIZE;
+    tiles.push(t * thread_count / tile_count,
+               Tile{static_cast<u32>(x), static_cast<u32>(y),
+                    static_cast<u32>(std::min(TILE_SIZE, width - x)),
+                    static_cast<u32>(std::min(TILE_SIZE, height - y)), 0,
+                    static_cast<u32>(settings.samples_per_pixel)});
+  }
+  tiles_left.store(tile_count, std::memory_order_relaxed);
 
   // launch the threads
-  auto *const end = data.get() + width * height;
-  for (size_t i = 0; i != NUM_THREADS; ++i) {
-    threads[i].launch(RenderRequest{&data[i * BLOCK_SIZE], end, i * BLOCK_SIZE,
-                                    width, height, virtual_viewport_width,
-                                    virtual_viewport_height, world});
+  const auto pixels = width * height;
+  for (size_t i = 0; i != thread_count; ++i) {
+    threads[i].launch(RenderRequest{target, accumulation.get(),
+                                    luminance_squares.get(), spare_samples,
+                                    tiles, tiles_left, dirty_tiles.data(),
+                                    tiles_x,
+                                    i * pixels / thread_count,
+                                    (i + 1) * pixels / thread_count, cleared,
+                                    width, height,
+                                    virtual_viewport_width,
+                                    virtual_viewport_height, settings,
+                                    scene});
   }
-  jobs_left = NUM_THREADS;
+  jobs_left = thread_count;
   timer.reset();
 }
 
 bool MainRenderThread::on_frame_update() {
   if (jobs_left) {
-    for (const RenderResult *res = nullptr;
+    for (std::optional<RenderResult> res;
          jobs_left && (res = results.try_pop()); --jobs_left) {
-      // Wait for thread to quit.
-      threads[res->worker_id].drop_thread();
+      worker_stats[res->worker_id] = res->stats;
     }
     if (!jobs_left) {
       last_render_time = timer.millis();
-      mainlog.info() << "Render finished after " << last_render_time << "ms\n";
+      size_t samples = 0;
+      for (const auto &stats : worker_stats)
+        samples += stats.samples;
+      mainlog.info() << "Render finished after " << last_render_time << "ms, "
+                     << samples << " samples\n";
+      for (size_t i = 0; i != thread_count; ++i) {
+        auto &stats = worker_stats[i];
+        stats.idle_ms = std::max(last_render_time - stats.busy_ms, 0.0);
+        mainlog.debug() << "worker{" << i << "}: busy " << stats.busy_ms
+                        << "ms, idle " << stats.idle_ms << "ms, "
+                        << stats.tiles << " tiles (" << stats.stolen_tiles
+                        << " stolen)\n";
+      }
     }
     return true;
   }
@@ -398,15 +515,64 @@ bool MainRenderThread::on_frame_update() {
   return false;
 }
 
-const u32 *MainRenderThread::get_data() const noexcept { return data.get(); }
+void MainRenderThread::take_dirty_rects(std::vector<Rect> &out) {
+  out.clear();
+  for (size_t t = 0; t != dirty_tiles.size(); ++t) {
+    if (!dirty_tiles[t].exchange(0, std::memory_order_acquire))
+      continue;
+    const auto x = static_cast<u32>(t % tiles_x * TILE_SIZE);
+    const auto y = static_cast<u32>(t / tiles_x * TILE_SIZE);
+    const auto tile_width =
+        static_cast<u32>(std::min(TILE_SIZE, frame_width - x));
+    const auto tile_height =
+        static_cast<u32>(std::min(TILE_SIZE, frame_height - y));
+    // extends the previous tile's rectangle if it's its left neighbour.
+    auto *last = out.empty() ? nullptr : &out.back();
+    if (last && last->y == y && last->x + last->width == x)
+      last->width += tile_width;
+    else
+      out.push_back(Rect{x, y, tile_width, tile_height});
+  }
+}
+
+void MainRenderThread::wait() {
+  while (jobs_left) {
+    on_frame_update();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+bool MainRenderThread::is_rendering() const noexcept { return jobs_left; }
+
+void MainRenderThread::set_settings(RenderSettings new_settings) noexcept {
+  new_settings.samples_per_pixel =
+      std::max<size_t>(new_settings.samples_per_pixel, 1);
+  new_settings.samples_per_pass = std::clamp<size_t>(
+      new_settings.samples_per_pass, 1, new_settings.samples_per_pixel);
+  new_settings.noise_threshold = std::max(new_settings.noise_threshold, 0.0);
+  new_settings.max_samples_per_pixel = std::max(
+      new_settings.max_samples_per_pixel, new_settings.samples_per_pixel);
+  settings = new_settings;
+}
+const RenderSettings &MainRenderThread::get_settings() const noexcept {
+  return settings;
+}
+size_t MainRenderThread::get_thread_count() const noexcept {
+  return thread_count;
+}
+
+const u32 *MainRenderThread::get_data() const noexcept { return target; }
 double MainRenderThread::get_last_render_time() const noexcept {
   return last_render_time;
 }
+const std::vector<WorkerStats> &
+MainRenderThread::get_worker_stats() const noexcept {
+  return worker_stats;
+}
 
 MainRenderThread::~MainRenderThread() {
-  if (jobs_left)
-    stop_pipeline();
-  for (size_t i = 0; i != NUM_THREADS; ++i) {
+  stop_pipeline();
+  for (size_t i = 0; i != thread_count; ++i) {
     threads[i].~WorkerThread();
   }
   operator delete[](threads);
@@ -1,116 +1,224 @@
 #pragma once
 #include "log.h"
+#include "random.h"
+#include "ray_tracer/generator.h"
+#include "ray_tracer/ray.h"
+#include "ray_tracer/sampler.h"
+#include "ray_tracer/scene.h"
+#include "ray_tracer/scene_cache.h"
+#include "ray_tracer/wavefront.h"
+#include "ray_tracer/world.h"
 #include "resize_enabled_array.h"
+#include "threading/affinity.h"
 #include "threading/mpsc.h"
 #include "threading/unique_signal.h"
+#include "threading/work_stealing.h"
+#include "timer.h"
 #include "types.h"
+#include <atomic>
+#include <barrier>
 #include <chrono>
+#include <condition_variable>
 #include <glm/glm.hpp>
 #include <memory>
+#include <mutex>
 #include <optional>
-#include <random>
+#include <string_view>
 #include <thread>
 #include <vector>
 
 namespace renderer {
 
-class Timer {
-  std::chrono::time_point<std::chrono::high_resolution_clock> start;
+struct RenderResult;
 
-public:
-  Timer() { reset(); }
-
-  void reset() noexcept { start = std::chrono::high_resolution_clock::now(); }
-  double millis() noexcept {
-    return std::chrono::duration_cast<std::chrono::nanoseconds>(
-               std::chrono::high_resolution_clock::now() - start)
-               .count() *
-           0.001 * 0.001;
-  }
+// rectangle of the frame, in pixels.
+struct Rect {
+  u32 x, y;
+  u32 width, height;
 };
-namespace ray_tracer {
-
-using vec3 = glm::highp_dvec3;
 
-struct material_traits;
-
-struct Ray {
-  vec3 origin;
-  vec3 direction; // normalized
-  vec3 at(double t) const noexcept;
+// rectangle of the frame rendered as a single unit of work. A tile is
+// rendered a pass at a time and queued again until it has all its samples.
+struct Tile {
+  u32 x, y;
+  u32 width, height;
+  u32 samples = 0; // accumulated so far, for every pixel in the tile
+  u32 allowed = 0; // samples the tile may take before it has to stop
 };
-struct Hit;
-
-struct Sphere {
-  vec3 center;
-  double radius;
 
-  bool intersect(Ray ray, Hit &hit) const noexcept;
-};
-struct World {
-  std::vector<std::unique_ptr<material_traits>> materials;
-  std::vector<std::pair<Sphere, size_t>> spheres;
-  size_t create_material(std::unique_ptr<material_traits> mat) noexcept;
-  const material_traits &material_at(size_t index) const noexcept;
-  void add(Sphere sphere, size_t material) noexcept;
-  bool intersect(Ray ray, Hit &hit) const noexcept;
-  std::pair<vec3, vec3> scatter(vec3 direction, Hit &hit_info,
-                                std::mt19937 &rand) const noexcept;
+// scalar type the rays are traced in. Float doubles the SIMD width and halves
+// the memory traffic; double copes with scenes spanning larger coordinates.
+enum class Precision { Double, Float };
+
+struct RenderSettings {
+  size_t samples_per_pixel = 100;
+  // samples added to a tile each time a worker picks it up. Lower values give
+  // a full (noisy) preview sooner.
+  size_t samples_per_pass = 1;
+
+  // adaptive sampling: a tile stops early once the standard error of every
+  // pixel's mean luminance is below this fraction of it. 0 disables it.
+  double noise_threshold = 0.01;
+  size_t min_samples_per_pixel = 16;
+  // tiles still noisy after `samples_per_pixel` samples may keep going up to
+  // this many, spending the samples saved by tiles that stopped early.
+  size_t max_samples_per_pixel = 400;
+
+  // every sample's random numbers are derived from this, its pixel and its
+  // index, so the same settings always produce the same image.
+  u64 seed = 0;
+  ray_tracer::SamplerKind sampler = ray_tracer::SamplerKind::Sobol;
+  ray_tracer::IntegratorKind integrator = ray_tracer::IntegratorKind::Path;
+  Precision precision = Precision::Double;
 };
 
-} // namespace ray_tracer
-struct RenderResult;
-// TODO: fill this lol
 struct RenderRequest {
-  u32 *start;
-  u32 *end;
-  size_t starting_index;
+  u32 *data;
+  // linear running sums of every sample taken. `data` holds their mean.
+  glm::vec3 *accumulation;
+  // running sums of every sample's squared luminance, for the variance.
+  float *luminance_squares;
+  // samples left unused by converged tiles, which noisy ones can claim.
+  std::atomic<size_t> &spare_samples;
+  threading::work_stealing_queues<Tile> &tiles;
+  // tiles queued or being rendered. The queues run dry while tiles other
+  // workers hold still have passes left, so only this reaching 0 ends the
+  // render.
+  std::atomic<size_t> &tiles_left;
+  // one flag per tile, in rows of `tiles_x`, set once a pass of the tile has
+  // been written to `data`.
+  std::atomic<u8> *dirty_tiles;
+  size_t tiles_x;
+  // every worker clears its own slice of `data` before anyone starts
+  // rendering, so freshly allocated pages land on the worker's NUMA node.
+  size_t clear_begin;
+  size_t clear_end;
+  std::barrier<> &cleared;
   size_t width;
   size_t height;
   double virtual_viewport_width;
   double virtual_viewport_height;
-  const ray_tracer::World &world_view;
+  RenderSettings settings;
+  // holds the world in both precisions. `settings.precision` picks one.
+  const ray_tracer::Scene &scene;
 };
 
 struct QuitSignal;
 
-// object the main thread will use to manage its workers
+// how a worker spent the last render.
+struct WorkerStats {
+  double busy_ms = 0.0; // rendering tiles
+  double idle_ms = 0.0; // looking for work or waiting for the others
+  size_t tiles = 0; // tile passes rendered
+  size_t samples = 0; // camera rays traced
+  size_t stolen_tiles = 0;
+};
+
+// object the main thread will use to manage its workers. The thread is
+// started once and sleeps between render requests.
 class WorkerThread {
   threading::mpsc_queue<RenderResult>
       &results; // reference to the queue in main thread to launch
-  std::optional<std::thread> handle;
   utils::Log logger;
-  bool const &cancel;
+  std::atomic<bool> const &cancel;
   size_t worker_id;
+  std::optional<u32> cpu;
+
+  std::mutex mutex;
+  std::condition_variable state_changed;
+  std::optional<RenderRequest> pending;
+  bool busy = false;
+  bool quitting = false;
+  // buffers of the wavefront integrator, kept between tiles.
+  ray_tracer::Wavefront<double> wavefront;
+  ray_tracer::Wavefront<float> wavefront_float;
+  std::thread handle; // started last, once everything above is ready
+
+  void run();
+  void render(const RenderRequest &request);
+  // traces `samples` samples of every pixel of `tile` and adds them to
+  // `color` and `squares`, in row order.
+  template <typename T>
+  void sample_tile(const RenderRequest &request, const Tile &tile,
+                   size_t samples, const ray_tracer::World<T> &world,
+                   ray_tracer::Wavefront<T> &wavefront, ray_tracer::vec3 *color,
+                   double *squares);
 
 public:
+  // pins itself to `cpu` when given.
   WorkerThread(size_t id, threading::mpsc_queue<RenderResult> &results,
-               bool const &cancel);
+               std::atomic<bool> const &cancel, std::optional<u32> cpu);
+  // hands a job to the worker and returns immediately.
   void launch(RenderRequest request);
-  void drop_thread();
+  // blocks until the current job (if any) finishes or is cancelled.
+  void wait_idle();
   ~WorkerThread();
 };
 
+// number of workers used when none is requested: $RAYTRACER_THREADS if set,
+// otherwise every CPU the process may run on.
+size_t default_thread_count();
+
 class MainRenderThread {
+  size_t thread_count;
+  threading::CpuTopology topology;
   WorkerThread *threads = nullptr; // managed manually
   threading::mpsc_queue<RenderResult> results;
   utils::alloc::resize_enabled_array<u32> data = nullptr;
+  // where the render goes: `data`, or the buffer given to `on_resize`.
+  u32 *target = nullptr;
+  utils::alloc::resize_enabled_array<glm::vec3> accumulation = nullptr;
+  utils::alloc::resize_enabled_array<float> luminance_squares = nullptr;
+  std::atomic<size_t> spare_samples = 0;
+  RenderSettings settings;
+  threading::work_stealing_queues<Tile> tiles;
+  std::atomic<size_t> tiles_left = 0;
+  // see `RenderRequest::dirty_tiles`.
+  std::vector<std::atomic<u8>> dirty_tiles;
+  size_t frame_width = 0, frame_height = 0, tiles_x = 0;
+  std::barrier<> cleared;
+  std::vector<WorkerStats> worker_stats;
   double virtual_viewport_width;
   double virtual_viewport_height;
   size_t jobs_left = 0;
   Timer timer;
-  double last_render_time;
-  alignas(64) bool cancel_signal;
-  ray_tracer::World world;
+  double last_render_time = 0.0;
+  alignas(64) std::atomic<bool> cancel_signal = false;
+  ray_tracer::Scene scene;
 
   void stop_pipeline();
 
 public:
-  MainRenderThread();
-  void on_resize(size_t width, size_t height);
+  // `thread_count` 0 means `default_thread_count()`.
+  explicit MainRenderThread(size_t thread_count = 0);
+  // replaces the scene with the one in `path`, keeping the current one if it
+  // can't be loaded. Stops the render in progress; `on_resize` starts the
+  // next.
+  bool load_scene(std::string_view path);
+  // replaces the scene with `new_scene`, which must have its acceleration
+  // structures built. Stops the render in progress like `load_scene`.
+  void set_scene(ray_tracer::Scene new_scene);
+  // (re)starts the render. Call it again to apply new settings. The image is
+  // written to `target`, `width * height` pixels that must stay valid until
+  // the next call, such as memory the viewport uploads from. Without one it
+  // goes to a buffer of the renderer's own.
+  void on_resize(size_t width, size_t height, u32 *target = nullptr);
+  void set_settings(RenderSettings new_settings) noexcept;
+  const RenderSettings &get_settings() const noexcept;
   // returns whether the data buffer could be updated
   bool on_frame_update();
+  // replaces `out` with the parts of the data buffer written since the last
+  // call: whole tiles, with neighbours in a row merged. Everything counts as
+  // written after `on_resize`.
+  void take_dirty_rects(std::vector<Rect> &out);
+  // blocks until the current render finishes. Used when there's no UI loop
+  // polling `on_frame_update`.
+  void wait();
+  bool is_rendering() const noexcept;
+  size_t get_thread_count() const noexcept;
   double get_last_render_time() const noexcept;
+  // per-worker timings of the last finished render.
+  const std::vector<WorkerStats> &get_worker_stats() const noexcept;
   const u32 *get_data() const noexcept;
   ~MainRenderThread();
 };
@@ -0,0 +1,303 @@
+#include "image_io.h"
+#include "log.h"
+#include "renderer.h"
+#include "types.h"
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Regression harness: renders a set of canned cases at fixed seeds and sample
+// counts and compares them against the reference images in
+// `<dir>/references`. With -p it also compares the rays per second of every
+// case against `<dir>/baseline.csv`, recorded on the same machine with -u.
+
+static utils::Log testlog("regression");
+
+namespace {
+using namespace renderer;
+
+constexpr size_t WIDTH = 160, HEIGHT = 120;
+
+struct Case {
+  std::string_view name;
+  std::function<void(RenderSettings &)> configure;
+  // file in `<dir>/scenes`, or empty for the built-in scene.
+  std::string_view scene = {};
+};
+
+// every case starts from these settings: a fixed seed and, unless the case
+// is about adaptive sampling, the same number of samples for every pixel.
+RenderSettings base_settings() {
+  RenderSettings settings;
+  settings.samples_per_pixel = 32;
+  settings.samples_per_pass = 32;
+  settings.max_samples_per_pixel = 128;
+  settings.noise_threshold = 0.0;
+  settings.seed = 1;
+  return settings;
+}
+
+const Case CASES[] = {
+    {"path_double", [](RenderSettings &) {}},
+    {"wavefront_float",
+     [](RenderSettings &s) {
+       s.integrator = ray_tracer::IntegratorKind::Wavefront;
+       s.precision = Precision::Float;
+     }},
+    {"random_sampler",
+     [](RenderSettings &s) { s.sampler = ray_tracer::SamplerKind::Random; }},
+    {"stratified_sampler",
+     [](RenderSettings &s) {
+       s.sampler = ray_tracer::SamplerKind::Stratified;
+     }},
+    {"halton_adaptive",
+     [](RenderSettings &s) {
+       s.sampler = ray_tracer::SamplerKind::Halton;
+       s.samples_per_pass = 4;
+       s.noise_threshold = 0.05;
+       s.min_samples_per_pixel = 8;
+     }},
+    {"materials_scene", [](RenderSettings &) {}, "materials.txt"},
+    {"mesh_scene",
+     [](RenderSettings &s) {
+       s.integrator = ray_tracer::IntegratorKind::Wavefront;
+       s.precision = Precision::Float;
+     },
+     "meshes.txt"},
+    {"instances_scene", [](RenderSettings &) {}, "instances.txt"},
+    {"packet_float",
+     [](RenderSettings &s) {
+       s.integrator = ray_tracer::IntegratorKind::Packet;
+       s.precision = Precision::Float;
+     },
+     "instances.txt"},
+};
+
+struct Difference {
+  double rmse; // in 8-bit channel units
+  double psnr; // in dB, infinite for identical images
+};
+
+Difference compare(const std::vector<u32> &a, const std::vector<u32> &b) {
+  double squares = 0.0;
+  for (size_t i = 0; i != a.size(); ++i) {
+    for (u32 shift = 0; shift != 24; shift += 8) {
+      const double d = static_cast<double>((a[i] >> shift) & 0xff) -
+                       static_cast<double>((b[i] >> shift) & 0xff);
+      squares += d * d;
+    }
+  }
+  const auto rmse = std::sqrt(squares / static_cast<double>(a.size() * 3));
+  return {rmse, 20.0 * std::log10(255.0 / rmse)};
+}
+
+struct Timing {
+  double ms;
+  double rays_per_second;
+};
+
+// case name -> timing. Missing or unreadable files are just empty.
+std::map<std::string, Timing, std::less<>>
+read_baseline(const std::string &path) {
+  std::map<std::string, Timing, std::less<>> baseline;
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line); // header
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string name;
+    Timing timing;
+    char comma;
+    if (std::getline(fields, name, ',') &&
+        fields >> timing.ms >> comma >> timing.rays_per_second)
+      baseline.emplace(std::move(name), timing);
+  }
+  return baseline;
+}
+
+bool parse_size(std::string_view text, size_t &out) {
+  const auto [ptr, err] =
+      std::from_chars(text.data(), text.data() + text.size(), out);
+  return err == std::errc() && ptr == text.data() + text.size() && out != 0;
+}
+
+bool parse_double(std::string_view text, double &out) {
+  const auto [ptr, err] =
+      std::from_chars(text.data(), text.data() + text.size(), out);
+  return err == std::errc() && ptr == text.data() + text.size();
+}
+
+void print_usage(const char *program) {
+  std::cerr << "usage: " << program
+            << " [-d tests directory] [-t threads] [-u] [-p]"
+               " [-P min PSNR] [-T max slowdown] [-r repetitions] [-v]\n"
+               "  -u  record the references (and with -p the baseline) "
+               "instead of checking them\n"
+               "  -p  also check rays per second against the baseline\n";
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string directory = "tests";
+  size_t thread_count = 0; // default_thread_count()
+  bool update = false;
+  bool check_performance = false;
+  // the references may come from another compiler or instruction set, so
+  // allow a small difference.
+  double min_psnr = 40.0;
+  double max_slowdown = 0.25;
+  size_t repetitions = 3;
+  utils::Log::set_level(utils::Log::Level::WARN);
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "-d" && has_value) {
+      directory = argv[++i];
+    } else if (arg == "-t" && has_value) {
+      if (!parse_size(argv[++i], thread_count)) {
+        testlog.error() << "Invalid thread count: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (arg == "-u") {
+      update = true;
+    } else if (arg == "-p") {
+      check_performance = true;
+    } else if (arg == "-P" && has_value) {
+      if (!parse_double(argv[++i], min_psnr)) {
+        testlog.error() << "Invalid PSNR: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (arg == "-T" && has_value) {
+      if (!parse_double(argv[++i], max_slowdown)) {
+        testlog.error() << "Invalid slowdown: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (arg == "-r" && has_value) {
+      if (!parse_size(argv[++i], repetitions)) {
+        testlog.error() << "Invalid repetition count: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (arg == "-v") {
+      utils::Log::set_level(utils::Log::Level::INFO);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  const auto baseline_path = directory + "/baseline.csv";
+  const auto baseline = read_baseline(baseline_path);
+  std::ostringstream new_baseline;
+  new_baseline << "case,ms,rays_per_second\n";
+
+  size_t failures = 0;
+  for (const auto &test : CASES) {
+    // a renderer per case, so scenes don't carry over.
+    MainRenderThread renderer(thread_count);
+    const auto scene_path = directory + "/scenes/" + std::string(test.scene);
+    if (!test.scene.empty() && !renderer.load_scene(scene_path)) {
+      ++failures;
+      continue;
+    }
+    auto settings = base_settings();
+    test.configure(settings);
+    renderer.set_settings(settings);
+
+    // the fastest of a few runs is the least disturbed by everything else
+    // running on the machine.
+    Timing timing{std::numeric_limits<double>::infinity(), 0.0};
+    for (size_t run = 0; run != (check_performance ? repetitions : 1);
+         ++run) {
+      renderer.on_resize(WIDTH, HEIGHT);
+      renderer.wait();
+      size_t samples = 0;
+      for (const auto &stats : renderer.get_worker_stats())
+        samples += stats.samples;
+      const auto ms = renderer.get_last_render_time();
+      if (ms < timing.ms)
+        timing = Timing{ms, samples / (ms * 0.001)};
+    }
+    new_baseline << test.name << ',' << timing.ms << ','
+                 << timing.rays_per_second << '\n';
+
+    const auto reference_path =
+        directory + "/references/" + std::string(test.name) + ".ppm";
+    if (update) {
+      if (!io::write_ppm(reference_path, renderer.get_data(), WIDTH, HEIGHT))
+        return 1;
+      testlog.ok() << test.name << ": recorded " << reference_path << '\n';
+      continue;
+    }
+
+    std::vector<u32> reference;
+    size_t width = 0, height = 0;
+    if (!io::read_ppm(reference_path, reference, width, height)) {
+      ++failures;
+      continue;
+    }
+    if (width != WIDTH || height != HEIGHT) {
+      testlog.error() << test.name << ": reference is " << width << 'x'
+                      << height << ", expected " << WIDTH << 'x' << HEIGHT
+                      << '\n';
+      ++failures;
+      continue;
+    }
+    // the renderer's alpha is always opaque, like the one read back.
+    const std::vector<u32> image(renderer.get_data(),
+                                 renderer.get_data() + WIDTH * HEIGHT);
+    const auto difference = compare(image, reference);
+    if (difference.psnr < min_psnr) {
+      testlog.error() << test.name << ": RMSE " << difference.rmse
+                      << ", PSNR " << difference.psnr << "dB (minimum "
+                      << min_psnr << "dB)\n";
+      ++failures;
+    } else {
+      testlog.ok() << test.name << ": RMSE " << difference.rmse << ", PSNR "
+                   << difference.psnr << "dB\n";
+    }
+
+    if (!check_performance)
+      continue;
+    const auto recorded = baseline.find(test.name);
+    if (recorded == baseline.end()) {
+      testlog.warn() << test.name << ": no baseline in " << baseline_path
+                     << ", run with -u -p to record one\n";
+      continue;
+    }
+    const auto ratio =
+        timing.rays_per_second / recorded->second.rays_per_second;
+    if (ratio < 1.0 - max_slowdown) {
+      testlog.error() << test.name << ": " << timing.rays_per_second
+                      << " rays/s, baseline "
+                      << recorded->second.rays_per_second << " ("
+                      << (1.0 - ratio) * 100.0 << "% slower)\n";
+      ++failures;
+    } else {
+      testlog.ok() << test.name << ": " << timing.rays_per_second
+                   << " rays/s, " << ratio * 100.0 << "% of the baseline\n";
+    }
+  }
+
+  if (update && check_performance) {
+    std::ofstream file(baseline_path);
+    file << new_baseline.str();
+    if (!file) {
+      testlog.error() << "Could not write " << baseline_path << '\n';
+      return 1;
+    }
+    testlog.ok() << "Recorded " << baseline_path << '\n';
+  }
+  if (failures) {
+    testlog.error() << failures << " failure(s)\n";
+    return 1;
+  }
+  return 0;
+}
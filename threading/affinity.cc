@@ -0,0 +1,118 @@
+#include "affinity.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace renderer::threading {
+
+#ifdef __linux__
+// parses the kernel's cpulist format, e.g. "0-15,32-47".
+static std::vector<u32> parse_cpu_list(const std::string &list) {
+  std::vector<u32> cpus;
+  std::istringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty() || range == "\n")
+      continue;
+    const auto dash = range.find('-');
+    const auto first = static_cast<u32>(std::stoul(range.substr(0, dash)));
+    const auto last =
+        dash == std::string::npos
+            ? first
+            : static_cast<u32>(std::stoul(range.substr(dash + 1)));
+    for (auto cpu = first; cpu <= last; ++cpu)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+#endif
+
+CpuTopology CpuTopology::detect() {
+  CpuTopology topology;
+#ifdef __linux__
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  const bool have_mask =
+      sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+  const auto is_allowed = [&](u32 cpu) {
+    return !have_mask || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed));
+  };
+
+  for (size_t node = 0;; ++node) {
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+                       "/cpulist");
+    if (!file)
+      break;
+    std::string list;
+    std::getline(file, list);
+    std::vector<u32> cpus;
+    try {
+      cpus = parse_cpu_list(list);
+    } catch (const std::exception &) {
+      // malformed entry, treat the machine as a single node below.
+      topology.nodes.clear();
+      break;
+    }
+    std::erase_if(cpus, [&](u32 cpu) { return !is_allowed(cpu); });
+    if (!cpus.empty())
+      topology.nodes.push_back(std::move(cpus));
+  }
+
+  if (topology.nodes.empty() && have_mask) {
+    std::vector<u32> cpus;
+    for (u32 cpu = 0; cpu != CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed))
+        cpus.push_back(cpu);
+    }
+    if (!cpus.empty())
+      topology.nodes.push_back(std::move(cpus));
+  }
+#endif
+  if (topology.nodes.empty()) {
+    std::vector<u32> cpus(std::max(std::thread::hardware_concurrency(), 1u));
+    for (u32 cpu = 0; cpu != cpus.size(); ++cpu)
+      cpus[cpu] = cpu;
+    topology.nodes.push_back(std::move(cpus));
+  }
+  return topology;
+}
+
+size_t CpuTopology::cpu_count() const noexcept {
+  size_t count = 0;
+  for (const auto &node : nodes)
+    count += node.size();
+  return count;
+}
+
+u32 CpuTopology::cpu_for(size_t index) const noexcept {
+  index %= cpu_count();
+  for (const auto &node : nodes) {
+    if (index < node.size())
+      return node[index];
+    index -= node.size();
+  }
+  return 0;
+}
+
+bool pin_current_thread(u32 cpu) {
+#ifdef __linux__
+  if (cpu >= CPU_SETSIZE)
+    return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+} // namespace renderer::threading
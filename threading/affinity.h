@@ -0,0 +1,24 @@
+#pragma once
+#include "types.h"
+#include <cstddef>
+#include <vector>
+
+namespace renderer::threading {
+
+// CPUs this process may run on, grouped by NUMA node. Machines (or platforms)
+// without NUMA information are reported as a single node.
+struct CpuTopology {
+  std::vector<std::vector<u32>> nodes;
+
+  static CpuTopology detect();
+  size_t cpu_count() const noexcept;
+  // CPU for the `index`-th worker. Workers fill one node before moving to the
+  // next, so neighbouring worker ids share a node.
+  u32 cpu_for(size_t index) const noexcept;
+};
+
+// pins the calling thread to `cpu`. Returns false where pinning isn't
+// supported or the CPU isn't available.
+bool pin_current_thread(u32 cpu);
+
+} // namespace renderer::threading
@@ -1,59 +1,82 @@
 #pragma once
 #include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <thread>
 
 namespace renderer::threading {
 
-// an mpsc queue
+// a bounded mpsc queue. Every slot carries a sequence number telling whether
+// it's ready to be written (== position) or read (== position + 1), so
+// producers only contend on the write handle and never on each other's
+// slots.
 template <typename T> class mpsc_queue {
-  T *buffer; // self-managed buffer
-  size_t read_handle;
+  struct slot {
+    std::atomic<size_t> sequence;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+  std::unique_ptr<slot[]> buffer;
+  size_t read_handle; // only touched by the consumer
   size_t cap;
-  std::atomic<size_t> write_handle;
-  std::atomic<size_t> elem_count;
+  alignas(64) std::atomic<size_t> write_handle;
 
 public:
   mpsc_queue(size_t capacity)
-      : buffer((T *)operator new[](sizeof(T) * capacity)), read_handle(0),
-        cap(capacity), write_handle(0), elem_count(0) {}
+      : buffer(std::make_unique<slot[]>(capacity)), read_handle(0),
+        cap(capacity), write_handle(0) {
+    for (size_t i = 0; i != capacity; ++i)
+      buffer[i].sequence.store(i, std::memory_order_relaxed);
+  }
 
-  ~mpsc_queue() { operator delete[](buffer); }
+  ~mpsc_queue() {
+    while (try_pop())
+      ;
+  }
 
-  T *try_pop() noexcept {
-    const auto write = write_handle.load(std::memory_order_relaxed);
-    if (write == read_handle) {
-      return nullptr; // queue is full or empty.
+  std::optional<T> try_pop() noexcept {
+    auto &s = buffer[read_handle % cap];
+    if (s.sequence.load(std::memory_order_acquire) != read_handle + 1) {
+      return std::nullopt; // queue is empty.
     }
-    T *ptr = &buffer[read_handle];
-    read_handle = (read_handle + 1) % cap;
-    elem_count.fetch_sub(1, std::memory_order_release);
-    return ptr;
+    T *ptr = std::launder(reinterpret_cast<T *>(s.storage));
+    std::optional<T> value(std::move(*ptr));
+    ptr->~T();
+    // hand the slot back to the producers for the next lap.
+    s.sequence.store(read_handle + cap, std::memory_order_release);
+    ++read_handle;
+    return value;
   }
 
   template <typename... Args> bool try_emplace(Args &&...args) {
-
-    // queue is full.
-    if (cap == elem_count.load(std::memory_order_acquire)) {
-      return false;
+    auto write = write_handle.load(std::memory_order_relaxed);
+    while (true) {
+      auto &s = buffer[write % cap];
+      const auto sequence = s.sequence.load(std::memory_order_acquire);
+      const auto diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(write);
+      if (diff == 0) {
+        // the slot is free. Claim it (no one else can store there).
+        if (write_handle.compare_exchange_weak(write, write + 1,
+                                               std::memory_order_relaxed)) {
+          new (s.storage) T(std::forward<Args>(args)...);
+          s.sequence.store(write + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false; // queue is full.
+      } else {
+        // someone else claimed it first.
+        write = write_handle.load(std::memory_order_relaxed);
+      }
     }
-    elem_count.fetch_add(1, std::memory_order_acquire);
-
-    // add 1 to ensure we get 'ownership' over that index (no one else can store
-    // there)
-    const auto write = write_handle.fetch_add(1, std::memory_order_acq_rel);
-
-    new (&buffer[write]) T(std::forward<Args &&...>(args...));
-
-    write_handle.store((write + 1) % cap, std::memory_order_release);
-
-    return true;
   }
 
-  template <typename... Args> void blocking_emplace(Args &&...args) {
-    // block until queue is not empty
-    while (cap == elem_count.load(std::memory_order_acquire))
-      ;
-    const auto write = write_handle.fetch_add(1, std::memory_order_acq_rel);
-    new (&buffer[write]) T(std::forward<Args &&...>(args...));
+  template <typename... Args> void blocking_emplace(const Args &...args) {
+    // block until the queue isn't full
+    while (!try_emplace(args...))
+      std::this_thread::yield();
   }
 
   bool try_push(T &&value) { return try_emplace(std::move(value)); }
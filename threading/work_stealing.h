@@ -0,0 +1,68 @@
+#pragma once
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace renderer::threading {
+
+// one deque of work items per worker. Owners take work from the front of their
+// own deque and push new work at the back, so items are handled in the order
+// they were queued (re-queued work goes after everything already waiting).
+// Once its deque is empty, a worker steals from the back of everyone else's,
+// away from where the owner is working.
+template <typename T> class work_stealing_queues {
+  // avoid false sharing between the workers' locks
+  struct alignas(64) queue {
+    std::mutex mutex;
+    std::deque<T> items;
+  };
+  std::unique_ptr<queue[]> queues;
+  size_t count;
+
+public:
+  explicit work_stealing_queues(size_t worker_count)
+      : queues(std::make_unique<queue[]>(worker_count)), count(worker_count) {}
+
+  size_t worker_count() const noexcept { return count; }
+
+  void push(size_t owner, T item) {
+    auto &q = queues[owner];
+    std::lock_guard lock(q.mutex);
+    q.items.push_back(std::move(item));
+  }
+
+  std::optional<T> pop(size_t owner) {
+    auto &q = queues[owner];
+    std::lock_guard lock(q.mutex);
+    if (q.items.empty())
+      return std::nullopt;
+    T item = std::move(q.items.front());
+    q.items.pop_front();
+    return item;
+  }
+
+  // tries every other worker once, starting with the next one so thieves
+  // spread out instead of all hitting worker 0.
+  std::optional<T> steal(size_t thief) {
+    for (size_t i = 1; i != count; ++i) {
+      auto &q = queues[(thief + i) % count];
+      std::lock_guard lock(q.mutex);
+      if (q.items.empty())
+        continue;
+      T item = std::move(q.items.back());
+      q.items.pop_back();
+      return item;
+    }
+    return std::nullopt;
+  }
+
+  void clear() {
+    for (size_t i = 0; i != count; ++i) {
+      std::lock_guard lock(queues[i].mutex);
+      queues[i].items.clear();
+    }
+  }
+};
+
+} // namespace renderer::threading
@@ -0,0 +1,21 @@
+#pragma once
+#include <chrono>
+
+namespace renderer {
+
+class Timer {
+  std::chrono::time_point<std::chrono::high_resolution_clock> start;
+
+public:
+  Timer() { reset(); }
+
+  void reset() noexcept { start = std::chrono::high_resolution_clock::now(); }
+  double millis() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::high_resolution_clock::now() - start)
+               .count() *
+           0.001 * 0.001;
+  }
+};
+
+} // namespace renderer
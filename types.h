@@ -4,3 +4,5 @@
 using u32 = uint32_t;
 using u64 = uint64_t;
 using u8 = uint8_t;
+using i32 = int32_t;
+using i64 = int64_t;
\ No newline at end of file